@@ -223,6 +223,15 @@
 #define HCLKRM		BIT(15)
 #define HCLKRDIV_MASK	0xfff
 
+/*
+ * DAVINCI_MCASP_XCLKCHK_REG / DAVINCI_MCASP_RCLKCHK_REG - Clock Check
+ *     Control Register Bits, same layout for both directions
+ */
+#define CLKCHK_PS(val)		(val)		/* SYSCLK / 2^val, 0..8 */
+#define CLKCHK_MIN(val)		((val) << 8)
+#define CLKCHK_MAX(val)		((val) << 16)
+#define CLKCHK_CNT(reg)		(((reg) >> 24) & 0xFF)
+
 /*
  * DAVINCI_MCASP_SRCTL_BASE_REG -  Serializer Control Register Bits
  */
@@ -268,6 +277,8 @@
 #define XSRCLR		BIT(10)	/* Transmit Serializer Clear */
 #define XSMRST		BIT(11)	/* Transmitter State Machine Reset */
 #define XFSRST		BIT(12)	/* Frame Sync Generator Reset */
+#define RGBLCTL_MASK	(RCLKRST | RHCLKRST | RSRCLR | RSMRST | RFSRST)
+#define XGBLCTL_MASK	(XCLKRST | XHCLKRST | XSRCLR | XSMRST | XFSRST)
 
 /*
  * DAVINCI_MCASP_XSTAT_REG - Transmitter Status Register Bits
@@ -0,0 +1,57 @@
+/*
+ * mcasp_client.h
+ *
+ * In-kernel interface of the McASP serial driver. Lets another module own
+ * an instance and move words without going through the char device.
+ */
+
+#ifndef MCASP_CLIENT_H
+#define MCASP_CLIENT_H
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+#include "mcasp_ioctl.h"
+
+struct davinci_mcasp;
+
+/*
+ * TX buffer handed to the worker. buf must stay valid until complete() is
+ * called, from the worker, once the last word is loaded into the FIFO.
+ * status is 0 or -ECANCELED/-ESHUTDOWN when the request was dropped.
+ */
+struct mcasp_tx_req {
+	const u32 *buf;
+	unsigned int words;
+	void (*complete)(struct mcasp_tx_req *req, int status);
+	void *context;
+
+	/* private to the driver */
+	struct list_head node;
+	unsigned int pos;
+};
+
+/*
+ * Called from the worker with every batch read from the RX FIFO, except
+ * during a self-test. Runs in the polling loop, keep it short.
+ */
+typedef void (*mcasp_rx_handler_t)(void *context, const u32 *words, unsigned int count);
+
+/*
+ * name is the device name, NULL takes the first unclaimed instance. The
+ * claim holds a reference: if the instance is removed while claimed, the
+ * queued requests complete with -ESHUTDOWN, every later call returns
+ * -ENODEV and the memory stays valid until mcasp_client_release().
+ */
+struct davinci_mcasp *mcasp_client_claim(const char *name);
+void mcasp_client_release(struct davinci_mcasp *mcasp);
+
+int mcasp_client_set_profile(struct davinci_mcasp *mcasp, const struct mcasp_profile *p);
+int mcasp_client_switch_profile(struct davinci_mcasp *mcasp, int index);
+int mcasp_client_set_loopback(struct davinci_mcasp *mcasp, bool enable);
+
+int mcasp_client_submit(struct davinci_mcasp *mcasp, struct mcasp_tx_req *req);
+int mcasp_client_set_rx_handler(struct davinci_mcasp *mcasp,
+	mcasp_rx_handler_t handler, void *context);
+
+#endif	/* MCASP_CLIENT_H */
@@ -0,0 +1,472 @@
+/*
+ * mcasp_ioctl.h
+ *
+ * Userspace interface of the McASP serial driver. Shared between the
+ * kernel module and userspace tools, so keep it free of kernel-only types.
+ */
+
+#ifndef MCASP_IOCTL_H
+#define MCASP_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define MCASP_IOC_MAGIC		'M'
+
+/*
+ * Self-test flags
+ */
+#define MCASP_SELFTEST_EXTERNAL	(1 << 0) /* keep loopback as is, TX is wired to RX externally */
+
+/*
+ * Loopback self-test. TX streams a PRBS-15 pattern, RX checks it.
+ * duration_ms and flags are inputs, everything else is filled by the driver.
+ */
+struct mcasp_selftest {
+	__u32 duration_ms;
+	__u32 flags;
+	__u64 elapsed_ns;
+	__u64 tx_words;
+	__u64 rx_words;
+	__u64 words_per_sec;
+	__u64 bit_errors;
+	__u64 word_errors;
+	__u32 resyncs;
+	__u32 locked;
+	__u32 underruns;
+	__u32 overruns;
+};
+
+/*
+ * Profile flags
+ */
+#define MCASP_PROFILE_BURST	(1 << 0) /* burst mode, one word per frame sync, no idle filler */
+#define MCASP_PROFILE_RX_EXT_CLK	(1 << 1) /* ACLKR/AFSR driven by the remote side, implies ASYNC */
+#define MCASP_PROFILE_TX_EXT_CLK	(1 << 2) /* ACLKX/AFSX driven by the remote side */
+#define MCASP_PROFILE_ASYNC	(1 << 3) /* RX clocked independently of TX */
+/*
+ * A remote bit clock cannot be seen by XCLKCHK/RCLKCHK, those measure the
+ * internal AHCLK. It counts as lost, with MCASP_EVENT_CLOCK_FAIL, once no
+ * data moved in that direction for 50 ms.
+ */
+#define MCASP_PROFILE_FLAGS	(MCASP_PROFILE_BURST | MCASP_PROFILE_RX_EXT_CLK | \
+				 MCASP_PROFILE_TX_EXT_CLK | MCASP_PROFILE_ASYNC)
+
+#define MCASP_MAX_PROFILES	4
+#define MCASP_PROFILE_ACTIVE	0xFFFFFFFF /* GET_PROFILE index for the running profile */
+
+/*
+ * Link configuration profile. Profiles are compiled to register values when
+ * set, switching only reprograms the registers that differ and restarts only
+ * the direction that is affected. Profile 0 holds the probe defaults.
+ *
+ * In burst mode slots, slot_mask and fs_width are ignored: every word gets
+ * its own slot wide frame sync and the optional chip select GPIO frames
+ * one transaction at a time: a write() (a short write splits it), a queue
+ * entry, an in-kernel client request or a block. The next transaction
+ * waits until the words of the current one have come back, or have had
+ * twice their time on the wire. The GPIO is driven by the worker, so it
+ * drops up to one worker pass after the last bit.
+ */
+struct mcasp_profile {
+	__u32 index;		/* profile slot, < MCASP_MAX_PROFILES */
+	__u32 slots;		/* TDM slots per frame, 2..32 */
+	__u32 slot_mask;	/* active TDM slots */
+	__u32 word_mask;	/* valid bits of each word */
+	__u32 slot_size;	/* bits per slot, 8..32 in steps of 4 */
+	__u32 data_delay;	/* frame sync to data delay in bits, 0..2 */
+	__u32 fs_width;		/* 0 - single bit frame sync, 1 - one slot wide */
+	__u32 clk_div;		/* bit clock = AHCLK / (clk_div + 1), 0..31 */
+	__u32 hclk_div;		/* AHCLK = fclk / (hclk_div + 1), 0..4095 */
+	__u32 tx_serializer;	/* AXR pin used for TX */
+	__u32 rx_serializer;	/* AXR pin used for RX */
+	__u32 flags;		/* MCASP_PROFILE_* */
+};
+
+/*
+ * Shared memory transaction queues, mmap() the device at offset 0 with
+ * MCASP_QUEUE_MAP_SIZE bytes. Userspace fills submission entries and bumps
+ * sq_tail, the worker executes them back to back and posts completions at
+ * cq_tail. TX/RX buffers are byte offsets into the data area, lengths are
+ * in words. Ring indices are free running, slot = index % entries.
+ * RX words that belong to TX still queued in the FIFOs when the transaction
+ * starts are left to readers, rx_skip only has to cover the fixed delay
+ * of the link.
+ */
+#define MCASP_QUEUE_ENTRIES	256
+#define MCASP_QUEUE_DATA_SIZE	65536
+#define MCASP_QUEUE_SQ_OFF	4096
+#define MCASP_QUEUE_CQ_OFF	(MCASP_QUEUE_SQ_OFF + MCASP_QUEUE_ENTRIES * 32)
+#define MCASP_QUEUE_DATA_OFF	(MCASP_QUEUE_CQ_OFF + MCASP_QUEUE_ENTRIES * 32)
+#define MCASP_QUEUE_MAP_SIZE	(MCASP_QUEUE_DATA_OFF + MCASP_QUEUE_DATA_SIZE)
+
+struct mcasp_queue_hdr {
+	__u32 sq_head;		/* advanced by the driver */
+	__u32 sq_tail;		/* advanced by userspace */
+	__u32 cq_head;		/* advanced by userspace */
+	__u32 cq_tail;		/* advanced by the driver */
+	__u32 entries;
+	__u32 data_size;
+	__u32 sq_off;
+	__u32 cq_off;
+	__u32 data_off;
+	__u32 map_size;
+};
+
+struct mcasp_sqe {
+	__u64 user_data;	/* cookie, returned in the completion */
+	__u32 tx_off;
+	__u32 tx_len;
+	__u32 rx_off;
+	__u32 rx_len;
+	__u32 rx_skip;		/* RX words to drop after the first word of its own TX */
+	__u32 flags;
+};
+
+struct mcasp_cqe {
+	__u64 user_data;
+	__s32 status;		/* 0 or negative errno */
+	__u32 rx_len;		/* words stored at rx_off */
+	__u64 start_ns;		/* CLOCK_MONOTONIC when the worker picked it up */
+	__u64 complete_ns;
+};
+
+struct mcasp_link_stats {
+	__u32 starts;		/* stream (re)starts since probe */
+	__u32 tx_underruns;
+	__u32 rx_overruns;
+	__u32 start_errors;	/* GBLCTL bits that did not latch in time */
+	__u64 start_ns;		/* duration of the last GBLCTL bring-up */
+	__u64 first_frame_ns;	/* last start request to first received word */
+};
+
+/*
+ * Latest value RX. After MCASP_IOC_SET_RX_LATEST(1) read() on that file
+ * returns one struct mcasp_latest holding the newest complete frame instead
+ * of consuming the stream, -EAGAIN until the first frame. The worker
+ * overwrites the snapshot on every frame and never waits for readers, a
+ * read costs the same whatever the backlog. Frames come from the frame
+ * alignment above, so the same restrictions apply.
+ */
+struct mcasp_latest {
+	__u64 frame;		/* frames published since the first reader enabled it */
+	__u64 timestamp_ns;	/* CLOCK_MONOTONIC when the frame was drained */
+	__u32 words;		/* valid entries of data */
+	__u32 flags;		/* MCASP_FRAME_RESYNC */
+	__u32 data[32];		/* one word per active slot */
+};
+
+/*
+ * Clock monitor. Every interval_ms the driver reads the XCLKCHK/RCLKCHK
+ * counts (prescaled functional clock cycles per 32 AHCLK cycles) and turns
+ * them into AHCLK, bit clock (AHCLK / (clk_div + 1)) and frame rate. The
+ * prescaler is picked so the count at the nominal AHCLK is near 192, one
+ * count is about 0.5%, so tolerances tighter than that trip on
+ * quantization. The nominal bit clock comes from the profile dividers
+ * unless set here. A remote bit clock is not derived from AHCLK and cannot
+ * be measured this way, such a direction only reports ahclk_hz (see
+ * MCASP_PROFILE_FLAGS for how its loss is caught). Leaving the tolerance
+ * raises MCASP_EVENT_CLOCK_DRIFT once per excursion.
+ */
+struct mcasp_clkmon_cfg {
+	__u32 interval_ms;	/* 0 stops the monitor, 10..60000 */
+	__u32 tolerance_ppm;	/* 0 - measure only */
+	__u32 tx_nominal_hz;	/* 0 - from the profile */
+	__u32 rx_nominal_hz;
+};
+
+struct mcasp_clk_stats {
+	__u32 count;		/* last raw CLKCHK count, 0 or 255 - no clock */
+	__u32 nominal_hz;
+	__u32 bclk_hz;		/* last measurement, 0 without a clock */
+	__u32 bclk_min_hz;
+	__u32 bclk_max_hz;
+	__u32 frame_mhz;	/* frame rate in millihertz */
+	__s32 drift_ppm;	/* last measurement against nominal */
+	__u32 out_of_tolerance;	/* samples outside the tolerance */
+	__u32 ahclk_hz;		/* last AHCLK measurement, 0 without a clock */
+};
+
+struct mcasp_clkmon_stats {
+	__u64 samples;
+	struct mcasp_clk_stats tx;
+	struct mcasp_clk_stats rx;
+};
+
+/*
+ * Triggered capture. While armed the driver keeps the last pre_words RX
+ * words, on trigger it adds post_words more (the trigger word is the first
+ * of those) and freezes the window until CAPTURE_WAIT copies it out. A
+ * software trigger via CAPTURE_TRIGGER works with every trigger type. The
+ * GPIO triggers use the chip select line as an input, so they cannot be
+ * combined with a burst profile. Edges are on the physical pin level.
+ */
+#define MCASP_CAPTURE_MAX_WORDS	65536 /* pre_words + post_words */
+
+enum mcasp_capture_trigger {
+	MCASP_TRIGGER_OFF,		/* disarm */
+	MCASP_TRIGGER_MATCH,		/* (word & match_mask) == match_value */
+	MCASP_TRIGGER_SOFT,
+	MCASP_TRIGGER_GPIO_RISING,
+	MCASP_TRIGGER_GPIO_FALLING,
+	MCASP_TRIGGER_GPIO_BOTH,
+};
+
+struct mcasp_capture {
+	__u32 trigger;		/* enum mcasp_capture_trigger */
+	__u32 pre_words;
+	__u32 post_words;	/* >= 1 */
+	__u32 match_value;
+	__u32 match_mask;
+	__u32 reserved;
+};
+
+struct mcasp_capture_result {
+	__u64 buf;		/* userspace buffer for the window */
+	__u32 size;		/* buffer size in words, the window is truncated to it */
+	__u32 words;		/* out: words copied */
+	__u32 pre_words;	/* out: words before the trigger, < requested if armed late */
+	__u32 trigger_word;	/* out */
+	__u64 trigger_ns;	/* out: CLOCK_MONOTONIC of the trigger */
+};
+
+/*
+ * Block mode. TX data leaves in whole blocks of words payload words:
+ *   MCASP_BLOCK_SYNC, seq << 16, payload..., crc[31:16] << 16, crc[15:0] << 16
+ * The CRC32 (little endian, as crc32_le) covers the seq word and the payload
+ * after the XMASK/RMASK is applied. RX hunts for the sync word, verifies the
+ * block and passes only good payload on to readers. Header fields use the
+ * upper 16 bits, so the word mask must keep those.
+ */
+#define MCASP_BLOCK_MAX_WORDS	256
+#define MCASP_BLOCK_SYNC	0xB10C0000
+
+struct mcasp_block {
+	__u32 words;		/* payload words per block, 0 turns block mode off */
+	__u32 reserved;
+};
+
+struct mcasp_block_stats {
+	__u64 tx_blocks;
+	__u64 rx_blocks;	/* passed the CRC */
+	__u64 crc_errors;
+	__u64 seq_gaps;		/* blocks missing between good blocks */
+};
+
+/*
+ * Frame aligned RX. Readers get whole TDM frames, each behind a header:
+ *   MCASP_FRAME_SYNC | flags, word of the first active slot, ..., last active slot
+ * The worker locates the oldest RX FIFO word in the frame from RSLOT and the
+ * FIFO level, drops the partial frame and starts at the next one. After an
+ * overrun, sync error or restart it locates it again and sets
+ * MCASP_FRAME_RESYNC on the first frame delivered afterwards. Not available
+ * with block mode or a burst profile.
+ */
+#define MCASP_FRAME_SYNC	0xF8A40000
+#define MCASP_FRAME_RESYNC	(1 << 0) /* words were lost before this frame */
+
+struct mcasp_frame_stats {
+	__u64 frames;
+	__u64 resyncs;
+	__u64 dropped_words;	/* words of partial frames */
+};
+
+/*
+ * RX decimation of a 1 bit sigma-delta stream. Each received word carries
+ * 32 modulator bits, MSB first, read as +1 or -1. They go through an
+ * order stage CIC decimator and, when fir_taps is set, a FIR compensator
+ * running at the output rate. read() then returns one signed word per
+ * output sample instead of the raw words. The stream is taken as one
+ * channel, so the profile needs a single active slot, slot_size 32 and a
+ * word_mask of 0xFFFFFFFF (-EINVAL otherwise), and profiles that do not
+ * fit are refused with -EBUSY while it is enabled. The CIC runs modulo
+ * 2^32, so order * log2(ratio) must stay below 31. ratio 0 disables it.
+ * Cannot be combined with block mode or frame aligned and latest value RX.
+ */
+#define MCASP_DECIM_MAX_ORDER	5
+#define MCASP_DECIM_MAX_TAPS	32
+
+struct mcasp_decim_cfg {
+	__u32 ratio;		/* modulator bits per output sample, any value from 2 */
+	__u32 order;		/* CIC stages, 1..MCASP_DECIM_MAX_ORDER */
+	__u32 shift;		/* right shift of the CIC output, gain is ratio^order */
+	__u32 fir_taps;		/* 0 skips the compensator */
+	__u32 fir_shift;	/* right shift of the FIR sum */
+	__s16 fir[MCASP_DECIM_MAX_TAPS];
+};
+
+struct mcasp_decim_stats {
+	__u64 in_words;
+	__u64 out_samples;
+	__u64 clipped;		/* FIR results saturated to 32 bits */
+};
+
+/*
+ * Cyclic TX pattern. The worker replays the loaded words whenever nothing
+ * else is queued, in place of the idle filler of stream mode. Block mode
+ * and burst profiles keep their own idle behaviour. A new pattern waits
+ * until the current one wraps and then takes over, so every loop goes out
+ * whole. Loading words 0 stops the replay at the next wrap. Restarting TX
+ * starts the pattern again from its first word.
+ */
+#define MCASP_PATTERN_MAX_WORDS	65536
+
+struct mcasp_pattern {
+	__u64 buf;		/* userspace pointer to the words */
+	__u32 words;
+	__u32 reserved;
+};
+
+struct mcasp_pattern_status {
+	__u64 loops;		/* complete passes of a pattern */
+	__u64 swaps;		/* patterns taken over at a wrap */
+	__u32 words;		/* length of the pattern on the wire, 0 when idle */
+	__u32 pending;		/* a pattern is waiting for the wrap */
+};
+
+/*
+ * Priority TX lane. After MCASP_IOC_SET_TX_PRIO(1) writes on that file go
+ * to a separate ring that the worker drains ahead of all other TX data,
+ * without splitting a queue transaction, a scheduled block or a framed
+ * block. MCASP_IOC_SET_PRIO_SLOT reserves one active slot of the frame
+ * (index among the active slots, -1 releases it): that slot then carries
+ * only priority words or filler and all other data skips it. The slot
+ * excludes MCASP_IOC_SET_BLOCK and MCASP_IOC_SCHED_TX (-EBUSY either way
+ * round) and queue transactions, which complete with -EBUSY while it is
+ * set and keep it from being set while one is in flight. Latency is
+ * sampled per lane from write() to the last word of that write entering
+ * the FIFO, one sample in flight at a time.
+ */
+struct mcasp_lane_stats {
+	__u64 words;
+	__u64 samples;
+	__u64 last_ns;
+	__u64 max_ns;
+	__u64 total_ns;		/* total_ns / samples is the mean */
+};
+
+struct mcasp_tx_lanes {
+	struct mcasp_lane_stats bulk;
+	struct mcasp_lane_stats prio;
+};
+
+/*
+ * Scheduled TX. The block is held in a queue ordered by release frame and
+ * loaded so that its first word is the first slot of that frame. Frames
+ * count from the last TX start, an absolute CLOCK_MONOTONIC release is
+ * converted to the first frame that starts at or after it, so the block
+ * goes out up to one frame period late but never early. A block whose frame
+ * has passed goes out on the next frame and counts as late. Scheduled
+ * blocks cannot be mixed with block mode or a burst profile.
+ */
+#define MCASP_SCHED_FRAME	(1 << 0) /* release is a frame number */
+#define MCASP_SCHED_MAX_WORDS	256
+#define MCASP_SCHED_MAX_QUEUED	64
+
+struct mcasp_sched_tx {
+	__u64 release;		/* CLOCK_MONOTONIC ns, or frame with MCASP_SCHED_FRAME */
+	__u64 buf;		/* userspace pointer to the words */
+	__u32 words;
+	__u32 flags;
+};
+
+struct mcasp_sched_status {
+	__u64 frame;		/* frame on the wire now, estimated */
+	__u64 frame_ns;		/* frame period of the active profile */
+	__u64 released;
+	__u64 late;
+	__s64 last_error_ns;	/* measured start of the last block minus its release time */
+	__u64 max_error_ns;	/* largest absolute error so far */
+	__u64 last_frame;	/* release frame of the last block */
+	__u32 queued;
+	__u32 reserved;
+};
+
+#define MCASP_IOC_SET_LOOPBACK	_IOW(MCASP_IOC_MAGIC, 0, int)
+#define MCASP_IOC_GET_LOOPBACK	_IOR(MCASP_IOC_MAGIC, 1, int)
+#define MCASP_IOC_SELFTEST	_IOWR(MCASP_IOC_MAGIC, 2, struct mcasp_selftest)
+#define MCASP_IOC_SET_PROFILE	_IOW(MCASP_IOC_MAGIC, 3, struct mcasp_profile)
+#define MCASP_IOC_GET_PROFILE	_IOWR(MCASP_IOC_MAGIC, 4, struct mcasp_profile)
+#define MCASP_IOC_SWITCH_PROFILE	_IOW(MCASP_IOC_MAGIC, 5, int)
+/* block until at least arg completions are posted, returns the number available */
+#define MCASP_IOC_QUEUE_WAIT	_IOW(MCASP_IOC_MAGIC, 6, __u32)
+#define MCASP_IOC_GET_STATS	_IOR(MCASP_IOC_MAGIC, 7, struct mcasp_link_stats)
+#define MCASP_IOC_CAPTURE_ARM	_IOW(MCASP_IOC_MAGIC, 8, struct mcasp_capture)
+#define MCASP_IOC_CAPTURE_TRIGGER	_IO(MCASP_IOC_MAGIC, 9)
+/* block until the armed capture completes and copy the window out */
+#define MCASP_IOC_CAPTURE_WAIT	_IOWR(MCASP_IOC_MAGIC, 10, struct mcasp_capture_result)
+#define MCASP_IOC_SET_BLOCK	_IOW(MCASP_IOC_MAGIC, 11, struct mcasp_block)
+#define MCASP_IOC_GET_BLOCK_STATS	_IOR(MCASP_IOC_MAGIC, 12, struct mcasp_block_stats)
+#define MCASP_IOC_SCHED_TX	_IOW(MCASP_IOC_MAGIC, 13, struct mcasp_sched_tx)
+#define MCASP_IOC_SCHED_STATUS	_IOR(MCASP_IOC_MAGIC, 14, struct mcasp_sched_status)
+#define MCASP_IOC_SET_FRAME_ALIGN	_IOW(MCASP_IOC_MAGIC, 15, int)
+#define MCASP_IOC_GET_FRAME_STATS	_IOR(MCASP_IOC_MAGIC, 16, struct mcasp_frame_stats)
+#define MCASP_IOC_SET_CLKMON	_IOW(MCASP_IOC_MAGIC, 17, struct mcasp_clkmon_cfg)
+#define MCASP_IOC_GET_CLKMON	_IOR(MCASP_IOC_MAGIC, 18, struct mcasp_clkmon_stats)
+#define MCASP_IOC_SET_TX_PRIO	_IOW(MCASP_IOC_MAGIC, 19, int)
+#define MCASP_IOC_SET_PRIO_SLOT	_IOW(MCASP_IOC_MAGIC, 20, int)
+#define MCASP_IOC_GET_TX_LANES	_IOR(MCASP_IOC_MAGIC, 21, struct mcasp_tx_lanes)
+#define MCASP_IOC_SET_RX_LATEST	_IOW(MCASP_IOC_MAGIC, 22, int)
+#define MCASP_IOC_SET_DECIM	_IOW(MCASP_IOC_MAGIC, 23, struct mcasp_decim_cfg)
+#define MCASP_IOC_GET_DECIM_STATS	_IOR(MCASP_IOC_MAGIC, 24, struct mcasp_decim_stats)
+#define MCASP_IOC_SET_PATTERN	_IOW(MCASP_IOC_MAGIC, 25, struct mcasp_pattern)
+#define MCASP_IOC_GET_PATTERN	_IOR(MCASP_IOC_MAGIC, 26, struct mcasp_pattern_status)
+
+/*
+ * Generic netlink family. The "stream" group carries RX words in blocks of
+ * MCASP_ATTR_BATCH words once streaming is enabled, the "events" group
+ * carries link events. Any number of processes can subscribe to both.
+ * MCASP_CMD_GET returns the link state, MCASP_CMD_SET changes it (admin).
+ */
+#define MCASP_GENL_NAME		"mcasp"
+#define MCASP_GENL_VERSION	1
+#define MCASP_GENL_MCGRP_STREAM	"stream"
+#define MCASP_GENL_MCGRP_EVENTS	"events"
+
+#define MCASP_GENL_MAX_BATCH	1024 /* words per RX block */
+
+enum mcasp_genl_cmd {
+	MCASP_CMD_UNSPEC,
+	MCASP_CMD_GET,		/* reply carries the state attributes */
+	MCASP_CMD_SET,		/* LOOPBACK, PROFILE, STREAM, BATCH */
+	MCASP_CMD_RX_BLOCK,	/* multicast: SEQ, TIMESTAMP, DROPPED, DATA */
+	MCASP_CMD_EVENT,	/* multicast: EVENT, COUNT, TIMESTAMP */
+	__MCASP_CMD_MAX,
+};
+#define MCASP_CMD_MAX		(__MCASP_CMD_MAX - 1)
+
+enum mcasp_genl_attr {
+	MCASP_ATTR_UNSPEC,
+	MCASP_ATTR_PAD,
+	MCASP_ATTR_LOOPBACK,	/* u8 */
+	MCASP_ATTR_PROFILE,	/* u32, active profile index */
+	MCASP_ATTR_STREAM,	/* u8, publish RX blocks */
+	MCASP_ATTR_BATCH,	/* u32, words per RX block, 1..MCASP_GENL_MAX_BATCH */
+	MCASP_ATTR_SEQ,		/* u32, RX block number, gaps mean lost blocks */
+	MCASP_ATTR_TIMESTAMP,	/* u64, CLOCK_MONOTONIC ns */
+	MCASP_ATTR_DROPPED,	/* u32, words the driver failed to publish */
+	MCASP_ATTR_DATA,	/* binary, RX words in host order */
+	MCASP_ATTR_EVENT,	/* u32, enum mcasp_event */
+	MCASP_ATTR_COUNT,	/* u32, occurrences of the event since probe */
+	MCASP_ATTR_STARTS,	/* u32 */
+	MCASP_ATTR_TX_UNDERRUNS,	/* u32 */
+	MCASP_ATTR_RX_OVERRUNS,	/* u32 */
+	MCASP_ATTR_CLOCK_FAILS,	/* u32 */
+	MCASP_ATTR_RECOVERIES,	/* u32 */
+	__MCASP_ATTR_MAX,
+};
+#define MCASP_ATTR_MAX		(__MCASP_ATTR_MAX - 1)
+
+enum mcasp_event {
+	MCASP_EVENT_NONE,
+	MCASP_EVENT_UNDERRUN,	/* TX FIFO ran dry */
+	MCASP_EVENT_OVERRUN,	/* RX FIFO overflowed */
+	MCASP_EVENT_CLOCK_FAIL,	/* AHCLK out of the CLKCHK window, or a remote bit clock stopped */
+	MCASP_EVENT_SYNC_ERROR,	/* unexpected frame sync */
+	MCASP_EVENT_LINK_DOWN,	/* a direction was stopped on error */
+	MCASP_EVENT_RECOVERED,	/* link restarted after LINK_DOWN */
+	MCASP_EVENT_CLOCK_DRIFT,	/* measured bit clock left the monitor tolerance */
+	__MCASP_EVENT_MAX,
+};
+
+#endif	/* MCASP_IOCTL_H */
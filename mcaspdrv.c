@@ -24,15 +24,46 @@
 #include <linux/sched.h>
 #include <linux/delay.h>
 #include <linux/jiffies.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/gpio/consumer.h>
+#include <linux/iopoll.h>
+#include <linux/workqueue.h>
+#include <linux/crc32.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/uio.h>
+#include <linux/seqlock.h>
+#include <linux/jump_label.h>
+#include <linux/kref.h>
 
 
 #include "mcasp.h"
+#include "mcasp_ioctl.h"
+#include "mcasp_client.h"
 
 #define FIFO_DEPTH			64
+#define FIFO_BATCH			6 // words moved per worker pass
 
 #define MCASP_BUF_SIZE		(PAGE_SIZE/4)
 #define MCASP_TX_BUF_SIZE	MCASP_BUF_SIZE
-#define MCASP_RX_BUF_SIZE	MCASP_BUF_SIZE
+
+#define MCASP_RX_RING_PAGES	8 // power of two
+#define MCASP_RX_PAGE_WORDS	(PAGE_SIZE / sizeof(u32))
+#define MCASP_RX_BUF_SIZE	(MCASP_RX_RING_PAGES * MCASP_RX_PAGE_WORDS)
+// most words the worker puts in the ring before publishing head: a CRC
+// block, above a frame plus header or 16 decimated samples per drained word
+#define MCASP_RX_UNPUBLISHED	MCASP_BLOCK_MAX_WORDS
+
+#define MCASP_NUM_SERIALIZERS	4
 
 #define AXRNTX			0 // TX serializer is AXR0
 #define AXRNRX			1 // RX serializer is AXR1
@@ -40,23 +71,73 @@
 #define TDM_SLOTS_CFG	0xFC // active TDM slots
 
 #define MASK			0xFFFF0000
+#define TX_FILLER		0xABCD0000 // sent when there is nothing queued
+
+#define GBLCTL_TIMEOUT_US	1000 // latch takes a few bit clocks
+
+/* shadow slots for the FIFO control registers, after the McASP register file */
+#define MCASP_REGCACHE_WFIFOCTL	(DAVINCI_MCASP_XBUF_REG(0) >> 2)
+#define MCASP_REGCACHE_RFIFOCTL	(MCASP_REGCACHE_WFIFOCTL + 1)
+#define MCASP_REGCACHE_SIZE	(MCASP_REGCACHE_RFIFOCTL + 1)
 
 #define CLK_DIV		23
 #define HCLK_DIV	9
 
-#define MCASP_DEBUG
-// #define MCASP_REG_DEBUG
+#define PRBS_SHIFT		16 // PRBS word sits in the unmasked upper half
+#define PRBS_SEED		0x7FFF
+#define PRBS_RESYNC		8 // consecutive bad words before relocking
+#define SELFTEST_DEFAULT_MS	1000
+#define SELFTEST_MAX_MS		60000
+
+#define MCASP_RECOVER_MS	10 // restart delay after a direction stopped on error
+#define MCASP_EXTCLK_TIMEOUT_MS	50 // no data moving on a remote bit clock for this long is a clock failure
+#define MCASP_BURST_CS_SLACK_NS	(100 * NSEC_PER_USEC) // chip select hold past the last word
+#define MCASP_TX_MARKS		64 // write() boundaries kept per TX lane for burst mode
+
+static bool loopback;
+module_param(loopback, bool, 0444);
+MODULE_PARM_DESC(loopback, "Enable internal TX to RX loopback at probe");
+
+/*
+ * Register dumps, off by default and flipped at runtime through
+ * /sys/module/mcaspdrv/parameters/reg_dump. Other diagnostics are dev_dbg
+ * and go through dynamic debug.
+ */
+static DEFINE_STATIC_KEY_FALSE(mcasp_reg_dump);
+
+static int mcasp_reg_dump_set(const char *val, const struct kernel_param *kp) {
+	bool enable;
+	int retval;
+
+	retval = kstrtobool(val, &enable);
+	if (retval)
+		return retval;
+
+	if (enable)
+		static_branch_enable(&mcasp_reg_dump);
+	else
+		static_branch_disable(&mcasp_reg_dump);
 
-#define MCASP_DEBUG_IRQTX
-#define MCASP_DEBUG_IRQRX
+	return 0;
+}
+
+static int mcasp_reg_dump_get(char *buf, const struct kernel_param *kp) {
+	return sprintf(buf, "%c\n", static_key_enabled(&mcasp_reg_dump) ? 'Y' : 'N');
+}
 
-#define REG_DUMP_FORCE(MCASP, REG) dev_info(MCASP->dev, #REG " is 0x%08X", mcasp_get_reg(MCASP, REG));
+static const struct kernel_param_ops mcasp_reg_dump_ops = {
+	.set = mcasp_reg_dump_set,
+	.get = mcasp_reg_dump_get,
+};
+module_param_cb(reg_dump, &mcasp_reg_dump_ops, NULL, 0644);
+MODULE_PARM_DESC(reg_dump, "Log register values during init and start");
 
-#ifdef MCASP_REG_DEBUG
-	#define REG_DUMP(MCASP, REG) dev_info(MCASP->dev, #REG " is 0x%08X", mcasp_get_reg(MCASP, REG));
-#else
-	#define REG_DUMP(MCASP, REG) /* noop */
-#endif // MCASP_REG_DEBUG
+/* hardware value next to the shadow, a register that did not latch shows up */
+#define REG_DUMP(MCASP, REG) do { \
+	if (static_branch_unlikely(&mcasp_reg_dump)) \
+		dev_info(MCASP->dev, #REG " is 0x%08X (shadow 0x%08X)", \
+			(u32)__raw_readl(MCASP->base + REG), mcasp_get_reg(MCASP, REG)); \
+} while (0)
 
 static const struct of_device_id mcasp_dt_ids[] = {
 	{
@@ -72,6 +153,341 @@ struct mycirc_buf {
 	int tail;
 };
 
+enum {
+	MCASP_LANE_BULK,
+	MCASP_LANE_PRIO,
+	MCASP_LANES,
+};
+
+/*
+ * Latency sample of one TX lane. The writer sets mark to the head after its
+ * words before publishing them, the worker closes the sample when the tail
+ * gets there.
+ */
+struct mcasp_tx_lat {
+	bool pending;
+	int mark;
+	u64 mark_ns;
+	struct mcasp_lane_stats stats;
+};
+
+/*
+ * Where each write() on a TX lane ended, recorded in burst mode only. The
+ * writer publishes the ring head first, so a mark never runs ahead of it.
+ */
+struct mcasp_tx_marks {
+	int end[MCASP_TX_MARKS];
+	u32 head; // advanced by the writer under tx_lock
+	u32 tail; // advanced by the worker
+};
+
+/*
+ * RX is broadcast to every open file. head runs free, the worker never
+ * waits for readers and each reader keeps its own position in mcasp_file.
+ * The ring is made of single pages so they can be spliced into pipes. A
+ * page that is still referenced when the worker comes round to it again is
+ * replaced by a fresh one, lock only guards pages[] against that swap.
+ */
+struct mcasp_rx_ring {
+	struct page *pages[MCASP_RX_RING_PAGES];
+	u32 *seg;
+	u32 head;
+	spinlock_t lock;
+	u32 flips;
+};
+
+struct mcasp_stats {
+	u32 tx_underruns;
+	u32 rx_overruns;
+	u32 starts;
+	u32 start_errors;
+	u32 clock_fails;
+	u32 sync_errors;
+	u32 recoveries;
+	u64 start_ns;
+	u64 first_frame_ns;
+};
+
+struct mcasp_selftest_state {
+	bool active;
+	bool stop;
+	struct completion done;
+
+	u16 tx_lfsr;
+	u16 rx_lfsr;
+	bool locked;
+	int bad_run;
+
+	u64 tx_words;
+	u64 rx_words;
+	u64 bit_errors;
+	u64 word_errors;
+	u32 resyncs;
+};
+
+/* per direction register values compiled from a profile */
+struct mcasp_dir_regs {
+	u32 mask;
+	u32 fmt;
+	u32 afsctl;
+	u32 aclkctl;
+	u32 ahclkctl;
+	u32 tdm;
+	u32 clkchk; // not cached, follows aclkctl
+};
+
+struct mcasp_regset {
+	struct mcasp_dir_regs tx;
+	struct mcasp_dir_regs rx;
+	u32 srctl[MCASP_NUM_SERIALIZERS];
+	u32 pdir;
+	int tx_ser;
+	int rx_ser;
+	bool burst;
+	u32 ext_clk; // MCASP_PROFILE_*_EXT_CLK
+};
+
+struct mcasp_profile_slot {
+	bool valid;
+	struct mcasp_profile cfg;
+	struct mcasp_regset regs;
+};
+
+struct mcasp_queue {
+	void *mem;
+	struct mcasp_queue_hdr *hdr;
+	struct mcasp_sqe *sq;
+	struct mcasp_cqe *cq;
+	u8 *data;
+
+	/* private copies, userspace can scribble over the shared header */
+	u32 sq_head;
+	u32 cq_tail;
+
+	/* transaction in flight, owned by the worker */
+	bool busy;
+	struct mcasp_sqe cur;
+	u32 tx_done;
+	u32 rx_lead; // RX words still from earlier TX, left to the readers
+	u32 rx_passed;
+	u32 rx_skipped;
+	u32 rx_done;
+	u64 start_ns;
+
+	wait_queue_head_t wait;
+};
+
+/* where the words of a burst transaction come from */
+enum mcasp_burst_src {
+	MCASP_BURST_PRIO,	// one write() on the priority lane
+	MCASP_BURST_QUEUE,	// one submission queue entry
+	MCASP_BURST_CLIENT,	// one in-kernel client request
+	MCASP_BURST_BLOCK,	// one framed block
+	MCASP_BURST_BULK,	// one write() on the bulk lane
+	MCASP_BURST_SOURCES,
+};
+
+/* chip select window for burst mode, one per transaction, owned by the worker */
+struct mcasp_burst_state {
+	bool cs_active;
+	enum mcasp_burst_src src;
+	u32 left; // words of the transaction still to load, U32_MAX until its source says
+	u32 tx_words;
+	u32 rx_words; // words of this window clocked back in, never above tx_words
+	u64 deadline_ns; // window closes by then even if words went missing
+};
+
+struct mcasp_extclk_dir {
+	unsigned long seen; // jiffies of the last progress
+	bool lost;
+};
+
+/* remote bit clock watch, owned by the worker, reset while it is parked */
+struct mcasp_extclk {
+	u32 flags; // MCASP_PROFILE_*_EXT_CLK of the loaded profile
+	struct mcasp_extclk_dir tx;
+	struct mcasp_extclk_dir rx;
+	u64 tx_consumed; // words the FIFO had passed on at the last check
+	u64 rx_drained; // words read out of the RX FIFO
+	u64 rx_arrived; // drained plus FIFO level at the last check
+};
+
+enum mcasp_capture_states {
+	MCASP_CAPTURE_IDLE,
+	MCASP_CAPTURE_ARMED,
+	MCASP_CAPTURE_TRIGGERED,
+	MCASP_CAPTURE_DONE,
+};
+
+/*
+ * Triggered capture. The ioctl side posts a new configuration in req and
+ * bumps req_seq, the worker adopts it and owns everything below seq.
+ * fire is the software/GPIO trigger and may be set from any context.
+ */
+struct mcasp_capture_state {
+	struct mcasp_capture req;
+	u32 req_seq;
+	bool armed;
+	int irq;
+	bool fire;
+	u64 trigger_ns;
+	u32 *buf;
+
+	u32 seq;
+	struct mcasp_capture cfg;
+	int state;
+	u32 size;
+	u32 idx;
+	u32 count;
+	u32 post_left;
+	u32 pre_avail;
+	u32 trigger_word;
+
+	wait_queue_head_t wait;
+};
+
+/*
+ * Block framing, owned by the worker. The stages hold seq, payload and the
+ * two CRC halves so the CRC runs over a whole block in one crc32_le call.
+ */
+struct mcasp_block_state {
+	u32 words;
+
+	u32 tx_stage[MCASP_BLOCK_MAX_WORDS + 3];
+	u32 tx_pos;
+	u32 tx_seq;
+
+	u32 rx_stage[MCASP_BLOCK_MAX_WORDS + 3];
+	u32 rx_pos;
+	u32 rx_mask;
+	u32 rx_seq;
+	bool rx_synced;
+
+	struct mcasp_block_stats stats;
+};
+
+/*
+ * Frame aligned RX, owned by the worker. pos is the active slot index of
+ * the next word read from the FIFO, valid while aligned. Frames go to the
+ * RX ring when enabled and to the latest snapshot while files read that.
+ */
+struct mcasp_frame_state {
+	bool enabled;
+	u32 latest_users;
+	bool aligned;
+	bool broken; // current frame lost words, drop it
+	bool resync; // flag the next delivered frame
+	u32 words;
+	u32 pos;
+	u32 slot_mask;
+	u32 errors; // overruns + sync errors seen so far
+
+	u32 stage[32];
+
+	struct mcasp_frame_stats stats;
+
+	seqcount_t latest_seq;
+	struct mcasp_latest latest;
+};
+
+/* RX decimator, cfg changes with the worker parked, the rest is owned by it */
+struct mcasp_decim {
+	struct mcasp_decim_cfg cfg;
+	u32 integ[MCASP_DECIM_MAX_ORDER];
+	u32 comb[MCASP_DECIM_MAX_ORDER];
+	u32 phase; // bits left until the next output sample
+	s32 hist[MCASP_DECIM_MAX_TAPS];
+	u32 hist_pos;
+
+	struct mcasp_decim_stats stats;
+};
+
+struct mcasp_pattern_buf {
+	u32 words;
+	u32 data[];
+};
+
+/* cyclic TX pattern, next is handed over with xchg, the rest is owned by the worker */
+struct mcasp_pattern_state {
+	struct mcasp_pattern_buf *next;
+	struct mcasp_pattern_buf *cur;
+	u32 pos;
+
+	struct mcasp_pattern_status stats;
+};
+
+/* periodic CLKCHK sampling, cfg and stats under mcasp->lock */
+struct mcasp_clkmon {
+	struct mcasp_clkmon_cfg cfg;
+	struct mcasp_clkmon_stats stats;
+	bool tx_out;
+	bool rx_out;
+	struct delayed_work work;
+};
+
+struct mcasp_sched_entry {
+	struct list_head node;
+	u64 frame;
+	u64 target_ns;
+	u32 words;
+	u32 data[];
+};
+
+/*
+ * Scheduled TX. queue is sorted by frame and shared with the ioctl under
+ * lock, the word and frame counters and cur are owned by the worker.
+ * Timing is set up in mcasp_start_tx while the worker is parked.
+ */
+struct mcasp_sched {
+	spinlock_t lock;
+	struct list_head queue;
+	u32 queued;
+
+	u32 words_per_frame;
+	u64 slot_ns;
+	u64 frame_ns;
+	u64 start_ns;
+
+	u64 tx_words;
+	u64 tx_frame;
+	u32 frame_pos;
+
+	struct mcasp_sched_entry *cur;
+	u32 pos;
+
+	bool measuring;
+	u64 measure_word;
+	u64 measure_target;
+
+	struct mcasp_sched_status status;
+};
+
+/* netlink RX tap, block buffer and counters owned by the worker */
+struct mcasp_genl_stream {
+	bool enabled;
+	u32 batch;
+	u32 *buf;
+	u32 len;
+	u32 seq;
+	u64 first_ns;
+	u32 dropped;
+};
+
+/* in-kernel owner of the instance, see mcasp_client.h */
+struct mcasp_client_state {
+	struct list_head node; // on mcasp_instances
+	bool claimed;
+
+	spinlock_t lock; // tx_queue and gone
+	bool gone; // instance removed, only release is left to the client
+	struct list_head tx_queue;
+	struct mcasp_tx_req *cur; // worker only
+
+	// changed with the worker parked
+	mcasp_rx_handler_t rx_handler;
+	void *rx_context;
+};
+
 struct davinci_mcasp {
 	void __iomem *base;
 	void __iomem *dat;
@@ -79,13 +495,67 @@ struct davinci_mcasp {
 	struct clk *clk;
 
 	struct mycirc_buf tx_buf;
-	struct mycirc_buf rx_buf;
+	struct mycirc_buf prio_buf;
+	struct mcasp_tx_lat tx_lat[MCASP_LANES];
+	struct mcasp_tx_marks tx_marks[MCASP_LANES];
+	/* active slot index reserved for the priority lane, -1 for none */
+	int prio_slot;
+	struct mcasp_rx_ring rx_ring;
+	/* serializes TX ring producers */
+	struct mutex tx_lock;
 
 	struct cdev cdev;
 
 	int majorNum;
 
 	struct task_struct *worker;
+	bool running;
+
+	/* software copy of GBLCTL, written through the R/X aliases */
+	u32 gblctl;
+	spinlock_t gblctl_lock; // error IRQs clear a half of it
+	ktime_t start_time;
+	bool first_frame_pending;
+
+	/* serializes ioctls that restart the link */
+	struct mutex lock;
+	bool loopback;
+
+	struct mcasp_stats stats;
+	struct mcasp_selftest_state selftest;
+
+	struct mcasp_queue *queue;
+
+	struct mcasp_profile_slot profiles[MCASP_MAX_PROFILES];
+	int cur_profile;
+	int tx_ser;
+	int rx_ser;
+	bool burst;
+
+	struct gpio_desc *cs_gpio;
+	struct mcasp_burst_state burst_state;
+	struct mcasp_extclk extclk;
+
+	u32 regcache[MCASP_REGCACHE_SIZE];
+
+	struct mcasp_capture_state capture;
+	struct mcasp_block_state block;
+	struct mcasp_frame_state frame;
+	struct mcasp_decim decim;
+	struct mcasp_pattern_state pattern;
+	struct mcasp_sched sched;
+	struct mcasp_clkmon clkmon;
+
+	struct mcasp_client_state client;
+	struct kref ref; // probe and a claiming client, the struct outlives remove
+
+	bool genl_registered;
+	struct mcasp_genl_stream stream;
+	/* MCASP_EVENT_* raised in IRQ context, sent from event_work */
+	unsigned long events;
+	struct work_struct event_work;
+	struct delayed_work recover_work;
+	bool shutdown;
 
 	u32 revision;
 };
@@ -96,628 +566,3893 @@ static int mcasp_start_rx(struct davinci_mcasp *);
 static int mcasp_stop(struct davinci_mcasp *);
 static int mcasp_stop_tx(struct davinci_mcasp *);
 static int mcasp_stop_rx(struct davinci_mcasp *);
+static int mcasp_set_loopback(struct davinci_mcasp *, bool);
+static int mcasp_selftest_run(struct davinci_mcasp *, struct mcasp_selftest *);
+static int mcasp_set_profile(struct davinci_mcasp *, const struct mcasp_profile *);
+static int mcasp_switch_profile(struct davinci_mcasp *, int);
+static struct mcasp_queue *mcasp_queue_get(struct davinci_mcasp *);
+static long mcasp_queue_wait(struct mcasp_queue *, u32);
+static int mcasp_capture_arm(struct davinci_mcasp *, const struct mcasp_capture *);
+static int mcasp_capture_trigger(struct davinci_mcasp *);
+static int mcasp_set_block(struct davinci_mcasp *, const struct mcasp_block *);
+static int mcasp_set_frame_align(struct davinci_mcasp *, bool);
+static int mcasp_set_decim(struct davinci_mcasp *, const struct mcasp_decim_cfg *);
+static int mcasp_clkmon_set(struct davinci_mcasp *, const struct mcasp_clkmon_cfg *);
+static int mcasp_set_prio_slot(struct davinci_mcasp *, int);
+static int mcasp_sched_submit(struct davinci_mcasp *, const struct mcasp_sched_tx *);
+static int mcasp_pattern_set(struct davinci_mcasp *, const struct mcasp_pattern *);
+static void mcasp_sched_get_status(struct davinci_mcasp *, struct mcasp_sched_status *);
+static int mcasp_capture_wait(struct davinci_mcasp *, struct mcasp_capture_result *);
+
+/* per open file state */
+struct mcasp_file {
+	struct davinci_mcasp *mcasp;
+	u32 rx_pos;
+	bool prio; // writes go to the priority lane
+	bool latest; // reads return the latest frame
+};
+
+static int mcasp_set_rx_latest(struct davinci_mcasp *, struct mcasp_file *, bool);
 
 static int mcasp_dev_open(struct inode *ino, struct file *filep) {
 	struct davinci_mcasp *mcasp = container_of(ino->i_cdev, struct davinci_mcasp, cdev);
-	filep->private_data = mcasp;
+	struct mcasp_file *mf;
+
+	mf = kzalloc(sizeof(*mf), GFP_KERNEL);
+	if (!mf)
+		return -ENOMEM;
+
+	// new readers only see words received after open
+	mf->mcasp = mcasp;
+	mf->rx_pos = smp_load_acquire(&mcasp->rx_ring.head);
+	filep->private_data = mf;
 	return 0;
 }
 
 static int mcasp_dev_release(struct inode *ino, struct file *filep) {
+	struct mcasp_file *mf = filep->private_data;
+
+	if (mf->latest) {
+		mutex_lock(&mf->mcasp->lock);
+		mcasp_set_rx_latest(mf->mcasp, mf, false);
+		mutex_unlock(&mf->mcasp->lock);
+	}
+
+	kfree(mf);
 	return 0;
 }
 
-static ssize_t mcasp_dev_read(struct file *filep, char __user *buf, size_t length, loff_t *offset) {
-	struct davinci_mcasp *mcasp = filep->private_data;
-	u32 val =  0;
-	ssize_t retval = 0;
-
-	// dev_info(mcasp->dev, "Mcasp ptr in read %p", mcasp);
-	// dev_info(mcasp->dev, "Read request on char dev. length:%zu offset:%lld head:%d tail:%d", length, *offset, mcasp->rx_buf.head, mcasp->rx_buf.tail);
-
-	// consumer for rx buf
-	if(CIRC_CNT(mcasp->rx_buf.head, mcasp->rx_buf.tail, MCASP_RX_BUF_SIZE) > 0) {
-		val = mcasp->rx_buf.buf[mcasp->rx_buf.tail];
-		mcasp->rx_buf.tail = (mcasp->rx_buf.tail + 1) & (MCASP_RX_BUF_SIZE - 1);
-		if(copy_to_user(buf, &val, sizeof(u32))) {
-			retval = -EFAULT;
-		}
+/* constant time, retries only if the worker published meanwhile */
+static ssize_t mcasp_latest_read(struct mcasp_file *mf, char __user *buf, size_t length) {
+	struct mcasp_frame_state *f = &mf->mcasp->frame;
+	struct mcasp_latest snap;
+	unsigned int seq;
 
-		retval = length;
-	} else {
-		dev_warn(mcasp->dev, "Cannot read, empty buffer head:%d, tail:%d", mcasp->rx_buf.head, mcasp->rx_buf.tail);
-	}
+	if (length < sizeof(snap))
+		return -EINVAL;
 
+	do {
+		seq = read_seqcount_begin(&f->latest_seq);
+		snap = f->latest;
+	} while (read_seqcount_retry(&f->latest_seq, seq));
 
-	return retval;
-}
+	if (!snap.frame)
+		return -EAGAIN;
+	if (copy_to_user(buf, &snap, sizeof(snap)))
+		return -EFAULT;
 
-static ssize_t mcasp_dev_write(struct file *filep, const char *buf, size_t length, loff_t *offset) {
-	struct davinci_mcasp *mcasp = filep->private_data;
-	ssize_t retval = 1;
-	u32 val;
+	return sizeof(snap);
+}
 
-	// dev_info(mcasp->dev, "Mcasp ptr in write %p", mcasp);
-	// dev_info(mcasp->dev, "Write request on char dev. length:%zu offset:%lld head:%d tail:%d", length, *offset, mcasp->tx_buf.head, mcasp->tx_buf.tail);
+/* page holding ring position pos, with a reference the caller drops */
+static struct page *mcasp_rx_ring_get_page(struct mcasp_rx_ring *ring, u32 pos) {
+	struct page *page;
 
-	// producer for tx buff
-	if(CIRC_SPACE(mcasp->tx_buf.head, mcasp->tx_buf.tail, MCASP_TX_BUF_SIZE) > 0) {
+	spin_lock(&ring->lock);
+	page = ring->pages[(pos / MCASP_RX_PAGE_WORDS) & (MCASP_RX_RING_PAGES - 1)];
+	get_page(page);
+	spin_unlock(&ring->lock);
 
-		if(copy_from_user(&val, buf, sizeof(u32))) {
-			retval = -EFAULT;
-		}
+	return page;
+}
 
-		mcasp->tx_buf.buf[mcasp->tx_buf.head] = val;
-		mcasp->tx_buf.head = (mcasp->tx_buf.head + 1) & (MCASP_TX_BUF_SIZE - 1);
-		// dev_info(mcasp->dev, "Wrote to tx_buf val:%x head:%d tail:%d", val, mcasp->tx_buf.head, mcasp->tx_buf.tail);
-		retval = length;
-	} else {
-		dev_warn(mcasp->dev, "Cannot write, buffer full head:%d, tail:%d", mcasp->tx_buf.head, mcasp->tx_buf.tail);
-	}
+static ssize_t mcasp_rx_lapped(struct mcasp_file *mf, u32 pos) {
 
-	return retval;
+	mf->rx_pos = smp_load_acquire(&mf->mcasp->rx_ring.head);
+	dev_dbg(mf->mcasp->dev, "RX reader overrun, skipped %u words", mf->rx_pos - pos);
+	return -EPIPE;
 }
 
 /*
- * Create a set of file operations for our proc files.
+ * Copies whatever is between the reader position and the ring head, never
+ * blocks. A reader that fell more than a ring behind gets -EPIPE once and
+ * continues from the current head, like /dev/kmsg.
  */
-static struct file_operations mcasp_file_ops = {
-	.owner   = THIS_MODULE,
-	.open    = mcasp_dev_open,
-	.write   = mcasp_dev_write,
-	.read    = mcasp_dev_read,
-	.release = mcasp_dev_release,
-};
+static ssize_t mcasp_dev_read(struct file *filep, char __user *buf, size_t length, loff_t *offset) {
+	struct mcasp_file *mf = filep->private_data;
+	struct mcasp_rx_ring *ring = &mf->mcasp->rx_ring;
+	u32 pos = mf->rx_pos;
+	u32 head, off, chunk;
+	size_t count, done = 0;
+	struct page *page;
+	unsigned long left;
+
+	if (mf->latest)
+		return mcasp_latest_read(mf, buf, length);
+
+	head = smp_load_acquire(&ring->head);
+	if (head - pos > MCASP_RX_BUF_SIZE)
+		return mcasp_rx_lapped(mf, pos);
+
+	count = min_t(size_t, head - pos, length / sizeof(u32));
+	while (done < count) {
+		off = (pos + done) & (MCASP_RX_PAGE_WORDS - 1);
+		chunk = min_t(size_t, count - done, MCASP_RX_PAGE_WORDS - off);
+
+		page = mcasp_rx_ring_get_page(ring, pos + done);
+		left = copy_to_user(buf + done * sizeof(u32), (u32 *)page_address(page) + off,
+			chunk * sizeof(u32));
+		put_page(page);
+		if (left)
+			return -EFAULT;
+
+		done += chunk;
+	}
 
-/*
- * Register handling stuff
-*/
+	if (!count)
+		return 0;
 
-static inline void mcasp_set_bits(struct davinci_mcasp *mcasp, u32 offset,
-				  u32 val)
-{
-	void __iomem *reg = mcasp->base + offset;
-	__raw_writel(__raw_readl(reg) | val, reg);
-}
+	// the slot at pos is reused once head gets a full ring ahead, and the
+	// worker writes up to a batch of output past the head it published
+	BUILD_BUG_ON(FIFO_BATCH * (32 + 1) > MCASP_RX_UNPUBLISHED);
+	smp_rmb();
+	if (READ_ONCE(ring->head) - pos > MCASP_RX_BUF_SIZE - MCASP_RX_UNPUBLISHED)
+		return mcasp_rx_lapped(mf, pos);
 
-static inline void mcasp_clr_bits(struct davinci_mcasp *mcasp, u32 offset,
-				  u32 val)
-{
-	void __iomem *reg = mcasp->base + offset;
-	__raw_writel((__raw_readl(reg) & ~(val)), reg);
+	mf->rx_pos = pos + count;
+	return count * sizeof(u32);
 }
 
-static inline void mcasp_mod_bits(struct davinci_mcasp *mcasp, u32 offset,
-				  u32 val, u32 mask)
-{
-	void __iomem *reg = mcasp->base + offset;
-	__raw_writel((__raw_readl(reg) & ~mask) | val, reg);
+static void mcasp_spd_release(struct splice_pipe_desc *spd, unsigned int i) {
+	put_page(spd->pages[i]);
 }
 
-static inline void mcasp_set_reg(struct davinci_mcasp *mcasp, u32 offset,
-				 u32 val)
-{
-	__raw_writel(val, mcasp->base + offset);
-}
+/*
+ * Hands ring pages to the pipe without copying. The worker must not come
+ * back to a page before the pipe holds its reference, so a splice reader
+ * counts as lapped one page earlier than a read() reader.
+ */
+static ssize_t mcasp_dev_splice_read(struct file *filep, loff_t *ppos,
+		struct pipe_inode_info *pipe, size_t len, unsigned int flags) {
+	struct mcasp_file *mf = filep->private_data;
+	struct mcasp_rx_ring *ring = &mf->mcasp->rx_ring;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &nosteal_pipe_buf_ops,
+		.spd_release = mcasp_spd_release,
+	};
+	u32 pos = mf->rx_pos;
+	u32 head, end, off, chunk;
+	ssize_t retval;
+	int i;
 
-static inline void mcasp_set_dat_reg(struct davinci_mcasp *mcasp, u32 offset,
-				 u32 val)
-{
-	__raw_writel(val, mcasp->dat + offset);
-}
+	head = smp_load_acquire(&ring->head);
+	if (head - pos > MCASP_RX_BUF_SIZE - MCASP_RX_PAGE_WORDS)
+		return mcasp_rx_lapped(mf, pos);
 
-static inline u32 mcasp_get_reg(struct davinci_mcasp *mcasp, u32 offset)
-{
-	return (u32)__raw_readl(mcasp->base + offset);
-}
+	end = pos + min_t(size_t, head - pos, len / sizeof(u32));
+	while (pos != end && spd.nr_pages < PIPE_DEF_BUFFERS) {
+		off = pos & (MCASP_RX_PAGE_WORDS - 1);
+		chunk = min_t(u32, end - pos, MCASP_RX_PAGE_WORDS - off);
 
-static inline u32 mcasp_get_dat_reg(struct davinci_mcasp *mcasp, u32 offset)
-{
-	return (u32)__raw_readl(mcasp->dat + offset);
+		pages[spd.nr_pages] = mcasp_rx_ring_get_page(ring, pos);
+		partial[spd.nr_pages].offset = off * sizeof(u32);
+		partial[spd.nr_pages].len = chunk * sizeof(u32);
+		spd.nr_pages++;
+		pos += chunk;
+	}
+
+	if (!spd.nr_pages)
+		return 0;
+
+	// with the references held the worker flips instead of overwriting
+	if (READ_ONCE(ring->head) - mf->rx_pos > MCASP_RX_BUF_SIZE - MCASP_RX_PAGE_WORDS) {
+		for (i = 0; i < spd.nr_pages; i++)
+			put_page(pages[i]);
+		return mcasp_rx_lapped(mf, mf->rx_pos);
+	}
+
+	retval = splice_to_pipe(pipe, &spd);
+	if (retval > 0)
+		mf->rx_pos += retval / sizeof(u32);
+
+	return retval;
 }
 
+/*
+ * Queues as many whole words as fit in the TX ring and returns the bytes
+ * taken, -EAGAIN when the ring is full, or in burst mode when too many
+ * earlier writes still wait for their window. Backs write() and splice_write.
+ */
+static ssize_t mcasp_dev_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+	struct mcasp_file *mf = iocb->ki_filp->private_data;
+	struct davinci_mcasp *mcasp = mf->mcasp;
+	struct mycirc_buf *tx = mf->prio ? &mcasp->prio_buf : &mcasp->tx_buf;
+	struct mcasp_tx_lat *lat = &mcasp->tx_lat[mf->prio ? MCASP_LANE_PRIO : MCASP_LANE_BULK];
+	struct mcasp_tx_marks *m = &mcasp->tx_marks[mf->prio ? MCASP_LANE_PRIO : MCASP_LANE_BULK];
+	size_t count, chunk, copied, done = 0;
+	bool burst;
+	int head;
 
-static void mcasp_set_ctl_reg(struct davinci_mcasp *mcasp, u32 ctl_reg, u32 val)
-{
-	int i = 0;
+	if (iov_iter_count(from) < sizeof(u32))
+		return -EINVAL;
 
-	mcasp_set_bits(mcasp, ctl_reg, val);
+	mutex_lock(&mcasp->tx_lock);
 
-	/* programming GBLCTL needs to read back from GBLCTL and verfiy */
-	/* loop count is to avoid the lock-up */
-	for (i = 0; i < 100000; i++) {
-		if ((mcasp_get_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG) & val) == val)
+	// producer for tx buff
+	head = tx->head;
+	count = min_t(size_t, CIRC_SPACE(head, READ_ONCE(tx->tail), MCASP_TX_BUF_SIZE),
+		iov_iter_count(from) / sizeof(u32));
+
+	// every write() gets its own chip select window in burst mode
+	burst = READ_ONCE(mcasp->burst);
+	if (burst && m->head - READ_ONCE(m->tail) >= MCASP_TX_MARKS)
+		count = 0;
+
+	while (done < count) {
+		chunk = min_t(size_t, count - done, MCASP_TX_BUF_SIZE - head);
+		copied = copy_from_iter(&tx->buf[head], chunk * sizeof(u32), from) / sizeof(u32);
+
+		head = (head + copied) & (MCASP_TX_BUF_SIZE - 1);
+		done += copied;
+		if (copied != chunk)
 			break;
 	}
 
-	if (i == 100000 && ((mcasp_get_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG) & val) != val))
-		dev_err(mcasp->dev, "GBLCTL write error\n");
+	// sample this write unless an earlier one is still in flight
+	if (done && !smp_load_acquire(&lat->pending)) {
+		lat->mark = head;
+		lat->mark_ns = ktime_get_ns();
+		smp_store_release(&lat->pending, true);
+	}
+
+	// words before the index, the worker reads them after it sees head
+	smp_wmb();
+	WRITE_ONCE(tx->head, head);
+
+	if (done && burst) {
+		m->end[m->head & (MCASP_TX_MARKS - 1)] = head;
+		smp_store_release(&m->head, m->head + 1);
+	}
+
+	mutex_unlock(&mcasp->tx_lock);
+
+	if (!done)
+		return count ? -EFAULT : -EAGAIN;
+
+	return done * sizeof(u32);
 }
 
-/*
- * end of register stuff
- */
+static long mcasp_dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+	struct mcasp_file *mf = filep->private_data;
+	struct davinci_mcasp *mcasp = mf->mcasp;
+	void __user *argp = (void __user *)arg;
+	struct mcasp_selftest st;
+	struct mcasp_profile profile;
+	struct mcasp_queue *q;
+	long retval = 0;
+	int val;
+	u32 count;
+
+	switch (cmd) {
+	case MCASP_IOC_SET_LOOPBACK:
+		if (get_user(val, (int __user *)argp))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_loopback(mcasp, val != 0);
+		mutex_unlock(&mcasp->lock);
+		break;
+
+	case MCASP_IOC_GET_LOOPBACK:
+		val = mcasp->loopback;
+		if (put_user(val, (int __user *)argp))
+			return -EFAULT;
+		break;
+
+	case MCASP_IOC_SELFTEST:
+		if (copy_from_user(&st, argp, sizeof(st)))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_selftest_run(mcasp, &st);
+		mutex_unlock(&mcasp->lock);
+
+		if (retval == 0 && copy_to_user(argp, &st, sizeof(st)))
+			return -EFAULT;
+		break;
+
+	case MCASP_IOC_SET_PROFILE:
+		if (copy_from_user(&profile, argp, sizeof(profile)))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_profile(mcasp, &profile);
+		mutex_unlock(&mcasp->lock);
+		break;
+
+	case MCASP_IOC_GET_PROFILE:
+		if (copy_from_user(&profile, argp, sizeof(profile)))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		if (profile.index == MCASP_PROFILE_ACTIVE)
+			profile.index = mcasp->cur_profile;
+
+		if (profile.index >= MCASP_MAX_PROFILES)
+			retval = -EINVAL;
+		else if (!mcasp->profiles[profile.index].valid)
+			retval = -ENOENT;
+		else
+			profile = mcasp->profiles[profile.index].cfg;
+		mutex_unlock(&mcasp->lock);
+
+		if (retval == 0 && copy_to_user(argp, &profile, sizeof(profile)))
+			return -EFAULT;
+		break;
+
+	case MCASP_IOC_SWITCH_PROFILE:
+		if (get_user(val, (int __user *)argp))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_switch_profile(mcasp, val);
+		mutex_unlock(&mcasp->lock);
+		break;
+
+	case MCASP_IOC_GET_STATS: {
+		struct mcasp_link_stats ls = {
+			.starts = mcasp->stats.starts,
+			.tx_underruns = mcasp->stats.tx_underruns,
+			.rx_overruns = mcasp->stats.rx_overruns,
+			.start_errors = mcasp->stats.start_errors,
+			.start_ns = mcasp->stats.start_ns,
+			.first_frame_ns = mcasp->stats.first_frame_ns,
+		};
+
+		if (copy_to_user(argp, &ls, sizeof(ls)))
+			return -EFAULT;
+		break;
+	}
 
-static int mcasp_worker(void *data) {
-	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
-	u32 wfifo, rfifo;
-	// u32 val, val1,val2,val3,val4,val5,val6;
-	u32 val;
-	int i;
+	case MCASP_IOC_CAPTURE_ARM: {
+		struct mcasp_capture cfg;
 
-	while(!kthread_should_stop()) {
-		wfifo = mcasp_get_reg(mcasp, MCASP_WFIFOSTS_REG);
-		rfifo = mcasp_get_reg(mcasp, MCASP_RFIFOSTS_REG);
-		// dev_info(mcasp->dev, "WFIFO: 0x%08X, RFIFO: 0x%08X", wfifo, rfifo);
+		if (copy_from_user(&cfg, argp, sizeof(cfg)))
+			return -EFAULT;
 
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_capture_arm(mcasp, &cfg);
+		mutex_unlock(&mcasp->lock);
+		break;
+	}
 
-		if(wfifo < (FIFO_DEPTH - 5)) {
-			for(i = 0; i < 6; i++) {
-				if(unlikely(CIRC_CNT(mcasp->tx_buf.head, mcasp->tx_buf.tail, MCASP_TX_BUF_SIZE) > 0)) {
-					val = mcasp->tx_buf.buf[mcasp->tx_buf.tail];
-					printk(KERN_INFO "wrote 0x%08X", val);
-					mcasp->tx_buf.tail = (mcasp->tx_buf.tail + 1) & (MCASP_TX_BUF_SIZE - 1);
-				} else {
-					val = 0xABCD0000;
-				}
-				mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), val);
-			}
-		}
+	case MCASP_IOC_CAPTURE_TRIGGER:
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_capture_trigger(mcasp);
+		mutex_unlock(&mcasp->lock);
+		break;
 
-		if(rfifo > 5) {
-			for(i = 0; i < 6; i++) {
-				val = mcasp_get_dat_reg(mcasp, DAVINCI_MCASP_RBUF_REG(AXRNRX));
-				// printk(KERN_INFO "read 0x%08X", val);
-				if(unlikely(CIRC_SPACE(mcasp->rx_buf.head, mcasp->rx_buf.tail, MCASP_RX_BUF_SIZE) > 6 && val != 0xABCD000)) {
-					mcasp->rx_buf.buf[mcasp->rx_buf.head] = val;
-					mcasp->rx_buf.head = (mcasp->rx_buf.head + 1) & (MCASP_RX_BUF_SIZE - 1);
-				}
-			}
-		}
+	case MCASP_IOC_CAPTURE_WAIT: {
+		struct mcasp_capture_result res;
 
-		schedule();
+		if (copy_from_user(&res, argp, sizeof(res)))
+			return -EFAULT;
+
+		retval = mcasp_capture_wait(mcasp, &res);
+		if (retval == 0 && copy_to_user(argp, &res, sizeof(res)))
+			return -EFAULT;
+		break;
 	}
 
-	return 0;
-}
+	case MCASP_IOC_SET_BLOCK: {
+		struct mcasp_block cfg;
 
-static irqreturn_t mcasp_tx_irq_handler(int irq, void *data)
-{
-	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
-	u32 handled_mask = 0;
-	u32 stat;
+		if (copy_from_user(&cfg, argp, sizeof(cfg)))
+			return -EFAULT;
 
-	stat = mcasp_get_reg(mcasp, DAVINCI_MCASP_XSTAT_REG);
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_block(mcasp, &cfg);
+		mutex_unlock(&mcasp->lock);
+		break;
+	}
 
-	if (unlikely(stat & XRDMAERR)) {
-		dev_err_ratelimited(mcasp->dev, "XDMAERR");
-		handled_mask |= XRDMAERR;
+	case MCASP_IOC_GET_BLOCK_STATS:
+		if (copy_to_user(argp, &mcasp->block.stats, sizeof(mcasp->block.stats)))
+			return -EFAULT;
+		break;
+
+	case MCASP_IOC_SET_FRAME_ALIGN:
+		if (get_user(val, (int __user *)argp))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_frame_align(mcasp, val != 0);
+		mutex_unlock(&mcasp->lock);
+		break;
+
+	case MCASP_IOC_SET_RX_LATEST:
+		if (get_user(val, (int __user *)argp))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_rx_latest(mcasp, mf, val != 0);
+		mutex_unlock(&mcasp->lock);
+		break;
+
+	case MCASP_IOC_SET_DECIM: {
+		struct mcasp_decim_cfg cfg;
+
+		if (copy_from_user(&cfg, argp, sizeof(cfg)))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_decim(mcasp, &cfg);
+		mutex_unlock(&mcasp->lock);
+		break;
 	}
 
-	if (unlikely(stat & XUNDRN)) {
-		dev_err_ratelimited(mcasp->dev, "XUNDRN");
-		handled_mask |= XUNDRN;
+	case MCASP_IOC_GET_DECIM_STATS:
+		if (copy_to_user(argp, &mcasp->decim.stats, sizeof(mcasp->decim.stats)))
+			return -EFAULT;
+		break;
+
+	case MCASP_IOC_GET_FRAME_STATS:
+		if (copy_to_user(argp, &mcasp->frame.stats, sizeof(mcasp->frame.stats)))
+			return -EFAULT;
+		break;
+
+	case MCASP_IOC_SET_CLKMON: {
+		struct mcasp_clkmon_cfg cfg;
+
+		if (copy_from_user(&cfg, argp, sizeof(cfg)))
+			return -EFAULT;
+
+		retval = mcasp_clkmon_set(mcasp, &cfg);
+		break;
 	}
 
-	if (unlikely(stat & XRCKFAIL)) {
-		dev_err_ratelimited(mcasp->dev, "XCKFAIL");
-		handled_mask |= XRCKFAIL;
+	case MCASP_IOC_GET_CLKMON: {
+		struct mcasp_clkmon_stats stats;
+
+		mutex_lock(&mcasp->lock);
+		stats = mcasp->clkmon.stats;
+		mutex_unlock(&mcasp->lock);
+
+		if (copy_to_user(argp, &stats, sizeof(stats)))
+			return -EFAULT;
+		break;
 	}
 
-	if (unlikely(stat & XRSYNCERR)) {
-		dev_err_ratelimited(mcasp->dev, "XSYNCERR");
-		handled_mask |= XRSYNCERR;
+	case MCASP_IOC_SET_TX_PRIO:
+		if (get_user(val, (int __user *)argp))
+			return -EFAULT;
+
+		mf->prio = val != 0;
+		break;
+
+	case MCASP_IOC_SET_PRIO_SLOT:
+		if (get_user(val, (int __user *)argp))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_set_prio_slot(mcasp, val);
+		mutex_unlock(&mcasp->lock);
+		break;
+
+	case MCASP_IOC_GET_TX_LANES: {
+		struct mcasp_tx_lanes lanes = {
+			.bulk = mcasp->tx_lat[MCASP_LANE_BULK].stats,
+			.prio = mcasp->tx_lat[MCASP_LANE_PRIO].stats,
+		};
+
+		if (copy_to_user(argp, &lanes, sizeof(lanes)))
+			return -EFAULT;
+		break;
 	}
 
-	if (unlikely(stat & XRERR)) {
-		dev_err_ratelimited(mcasp->dev, "XERR 0x%08X", stat);
-		mcasp_set_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, 0);
-		handled_mask |= XRERR;
+	case MCASP_IOC_SET_PATTERN: {
+		struct mcasp_pattern req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+
+		retval = mcasp_pattern_set(mcasp, &req);
+		break;
+	}
+
+	case MCASP_IOC_GET_PATTERN: {
+		struct mcasp_pattern_status status = mcasp->pattern.stats;
+
+		status.pending = READ_ONCE(mcasp->pattern.next) != NULL;
+		if (copy_to_user(argp, &status, sizeof(status)))
+			return -EFAULT;
+		break;
+	}
+
+	case MCASP_IOC_SCHED_TX: {
+		struct mcasp_sched_tx req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+
+		mutex_lock(&mcasp->lock);
+		retval = mcasp_sched_submit(mcasp, &req);
+		mutex_unlock(&mcasp->lock);
+		break;
 	}
 
-	/* Ack the handled event only */
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, handled_mask);
+	case MCASP_IOC_SCHED_STATUS: {
+		struct mcasp_sched_status status;
+
+		mutex_lock(&mcasp->lock);
+		mcasp_sched_get_status(mcasp, &status);
+		mutex_unlock(&mcasp->lock);
+
+		if (copy_to_user(argp, &status, sizeof(status)))
+			return -EFAULT;
+		break;
+	}
+
+	case MCASP_IOC_QUEUE_WAIT:
+		if (get_user(count, (u32 __user *)argp))
+			return -EFAULT;
+
+		q = READ_ONCE(mcasp->queue);
+		if (!q)
+			return -ENXIO;
+
+		retval = mcasp_queue_wait(q, count);
+		break;
+
+	default:
+		retval = -ENOTTY;
+	}
+
+	return retval;
+}
+
+static int mcasp_dev_mmap(struct file *filep, struct vm_area_struct *vma) {
+	struct mcasp_file *mf = filep->private_data;
+	struct davinci_mcasp *mcasp = mf->mcasp;
+	struct mcasp_queue *q;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > MCASP_QUEUE_MAP_SIZE)
+		return -EINVAL;
+
+	mutex_lock(&mcasp->lock);
+	q = mcasp_queue_get(mcasp);
+	mutex_unlock(&mcasp->lock);
+
+	if (!q)
+		return -ENOMEM;
+
+	return remap_vmalloc_range(vma, q->mem, 0);
+}
+
+/*
+ * Create a set of file operations for our proc files.
+ */
+static struct file_operations mcasp_file_ops = {
+	.owner   = THIS_MODULE,
+	.open    = mcasp_dev_open,
+	.write_iter = mcasp_dev_write_iter,
+	.read    = mcasp_dev_read,
+	.splice_read = mcasp_dev_splice_read,
+	.splice_write = iter_file_splice_write,
+	.unlocked_ioctl = mcasp_dev_ioctl,
+	.mmap    = mcasp_dev_mmap,
+	.release = mcasp_dev_release,
+};
+
+/*
+ * Register handling stuff
+*/
+
+/*
+ * Control registers are shadowed in mcasp->regcache so read-modify-write
+ * never has to go out on the L4 bus. Status, slot, clock check counters,
+ * GBLCTL (and its R/X aliases) and the data ports are volatile and always
+ * accessed directly.
+ */
+static inline int mcasp_reg_cache_slot(u32 offset)
+{
+	switch (offset) {
+	case DAVINCI_MCASP_PWRIDLESYSCONFIGT_REG:
+	case DAVINCI_MCASP_PFUNC_REG:
+	case DAVINCI_MCASP_PDIR_REG:
+	case DAVINCI_MCASP_PDOUT_REG:
+	case DAVINCI_MCASP_AMUTE_REG:
+	case DAVINCI_MCASP_DLBCTL_REG:
+	case DAVINCI_MCASP_DITCTL_REG:
+	case DAVINCI_MCASP_RMASK_REG:
+	case DAVINCI_MCASP_RFMT_REG:
+	case DAVINCI_MCASP_AFSRCTL_REG:
+	case DAVINCI_MCASP_ACLKRCTL_REG:
+	case DAVINCI_MCASP_AHCLKRCTL_REG:
+	case DAVINCI_MCASP_RTDM_REG:
+	case DAVINCI_MCASP_RINTCTL_REG:
+	case DAVINCI_MCASP_REVTCTL_REG:
+	case DAVINCI_MCASP_XMASK_REG:
+	case DAVINCI_MCASP_XFMT_REG:
+	case DAVINCI_MCASP_AFSXCTL_REG:
+	case DAVINCI_MCASP_ACLKXCTL_REG:
+	case DAVINCI_MCASP_AHCLKXCTL_REG:
+	case DAVINCI_MCASP_XTDM_REG:
+	case DAVINCI_MCASP_XINTCTL_REG:
+	case DAVINCI_MCASP_XEVTCTL_REG:
+	case DAVINCI_MCASP_SRCTL_REG(0):
+	case DAVINCI_MCASP_SRCTL_REG(1):
+	case DAVINCI_MCASP_SRCTL_REG(2):
+	case DAVINCI_MCASP_SRCTL_REG(3):
+		return offset >> 2;
+	case MCASP_WFIFOCTL_REG:
+		return MCASP_REGCACHE_WFIFOCTL;
+	case MCASP_RFIFOCTL_REG:
+		return MCASP_REGCACHE_RFIFOCTL;
+	default:
+		return -1;
+	}
+}
+
+static inline void mcasp_set_reg(struct davinci_mcasp *mcasp, u32 offset,
+				 u32 val)
+{
+	int slot = mcasp_reg_cache_slot(offset);
+
+	if (slot >= 0)
+		mcasp->regcache[slot] = val;
+
+	__raw_writel(val, mcasp->base + offset);
+}
+
+static inline u32 mcasp_get_reg(struct davinci_mcasp *mcasp, u32 offset)
+{
+	int slot = mcasp_reg_cache_slot(offset);
+
+	if (slot >= 0)
+		return mcasp->regcache[slot];
+
+	return (u32)__raw_readl(mcasp->base + offset);
+}
+
+/* write only if the value differs, cached registers never touch the bus otherwise */
+static inline void mcasp_update_reg(struct davinci_mcasp *mcasp, u32 offset,
+				 u32 val)
+{
+	int slot = mcasp_reg_cache_slot(offset);
+
+	if (slot >= 0 && mcasp->regcache[slot] == val)
+		return;
+
+	mcasp_set_reg(mcasp, offset, val);
+}
+
+static inline void mcasp_set_bits(struct davinci_mcasp *mcasp, u32 offset,
+				  u32 val)
+{
+	mcasp_update_reg(mcasp, offset, mcasp_get_reg(mcasp, offset) | val);
+}
+
+static inline void mcasp_clr_bits(struct davinci_mcasp *mcasp, u32 offset,
+				  u32 val)
+{
+	mcasp_update_reg(mcasp, offset, mcasp_get_reg(mcasp, offset) & ~(val));
+}
+
+static inline void mcasp_mod_bits(struct davinci_mcasp *mcasp, u32 offset,
+				  u32 val, u32 mask)
+{
+	mcasp_update_reg(mcasp, offset, (mcasp_get_reg(mcasp, offset) & ~mask) | val);
+}
+
+/* fill the shadow from hardware, the only time cached registers are read */
+static void mcasp_regcache_init(struct davinci_mcasp *mcasp)
+{
+	u32 offset;
+	int slot;
+
+	for (offset = 0; offset < DAVINCI_MCASP_XBUF_REG(0); offset += 4) {
+		slot = mcasp_reg_cache_slot(offset);
+		if (slot >= 0)
+			mcasp->regcache[slot] = __raw_readl(mcasp->base + offset);
+	}
+
+	mcasp->regcache[MCASP_REGCACHE_WFIFOCTL] = __raw_readl(mcasp->base + MCASP_WFIFOCTL_REG);
+	mcasp->regcache[MCASP_REGCACHE_RFIFOCTL] = __raw_readl(mcasp->base + MCASP_RFIFOCTL_REG);
+}
+
+static inline void mcasp_set_dat_reg(struct davinci_mcasp *mcasp, u32 offset,
+				 u32 val)
+{
+	__raw_writel(val, mcasp->dat + offset);
+}
+
+static inline u32 mcasp_get_dat_reg(struct davinci_mcasp *mcasp, u32 offset)
+{
+	return (u32)__raw_readl(mcasp->dat + offset);
+}
+
+/* the data port is a FIFO window, every access at offset pops or pushes one word */
+static inline void mcasp_write_dat_rep(struct davinci_mcasp *mcasp, u32 offset,
+				 const u32 *buf, u32 count)
+{
+	iowrite32_rep(mcasp->dat + offset, buf, count);
+}
+
+static inline void mcasp_read_dat_rep(struct davinci_mcasp *mcasp, u32 offset,
+				 u32 *buf, u32 count)
+{
+	ioread32_rep(mcasp->dat + offset, buf, count);
+}
+
+
+/*
+ * ctl_reg is RGBLCTL or XGBLCTL, the half is written from the software copy
+ * so no read is needed before the write. Programming GBLCTL needs to read
+ * back from GBLCTL and verify, the wait is bounded in time, not loop count.
+ */
+static int mcasp_set_ctl_reg(struct davinci_mcasp *mcasp, u32 ctl_reg, u32 val)
+{
+	u32 half = ctl_reg == DAVINCI_MCASP_XGBLCTL_REG ? XGBLCTL_MASK : RGBLCTL_MASK;
+	unsigned long flags;
+	u32 gblctl;
+	int retval;
+
+	spin_lock_irqsave(&mcasp->gblctl_lock, flags);
+	mcasp->gblctl |= val;
+	mcasp_set_reg(mcasp, ctl_reg, mcasp->gblctl & half);
+	spin_unlock_irqrestore(&mcasp->gblctl_lock, flags);
+
+	retval = readl_relaxed_poll_timeout_atomic(mcasp->base + DAVINCI_MCASP_GBLCTL_REG,
+		gblctl, (gblctl & val) == val, 0, GBLCTL_TIMEOUT_US);
+	if (retval) {
+		mcasp->stats.start_errors++;
+		dev_err_ratelimited(mcasp->dev, "GBLCTL write error 0x%08X\n", val);
+	}
+
+	return retval;
+}
+
+/* puts a whole direction back in reset, also called from the error IRQs */
+static void mcasp_clear_ctl_reg(struct davinci_mcasp *mcasp, u32 ctl_reg)
+{
+	u32 half = ctl_reg == DAVINCI_MCASP_XGBLCTL_REG ? XGBLCTL_MASK : RGBLCTL_MASK;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mcasp->gblctl_lock, flags);
+	mcasp->gblctl &= ~half;
+	mcasp_set_reg(mcasp, ctl_reg, 0);
+	spin_unlock_irqrestore(&mcasp->gblctl_lock, flags);
+}
+
+/*
+ * end of register stuff
+ */
+
+/*
+ * PRBS-15 (x^15 + x^14 + 1), 16 bits per call. The low 15 bits of the
+ * returned word are the new generator state, so the checker can seed itself
+ * from any received word.
+ */
+static inline u32 mcasp_prbs_next(u16 *lfsr)
+{
+	u32 s = *lfsr, out = 0, bit;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		bit = ((s >> 14) ^ (s >> 13)) & 1;
+		s = ((s << 1) | bit) & 0x7FFF;
+		out = (out << 1) | bit;
+	}
+
+	*lfsr = s;
+	return out;
+}
+
+static inline void mcasp_selftest_check(struct mcasp_selftest_state *st, u32 val)
+{
+	u32 word = val >> PRBS_SHIFT;
+	u32 diff;
+
+	if (!st->locked) {
+		// all zero state would never leave zero
+		if (word & 0x7FFF) {
+			st->rx_lfsr = word & 0x7FFF;
+			st->locked = true;
+			st->bad_run = 0;
+		}
+		return;
+	}
+
+	st->rx_words++;
+	diff = (mcasp_prbs_next(&st->rx_lfsr) ^ word) & 0xFFFF;
+	if (likely(!diff)) {
+		st->bad_run = 0;
+		return;
+	}
+
+	st->word_errors++;
+	st->bit_errors += hweight32(diff);
+
+	if (++st->bad_run >= PRBS_RESYNC) {
+		st->locked = false;
+		st->resyncs++;
+	}
+}
+
+/*
+ * Submission/completion queue, everything below runs in the worker
+ */
+static void mcasp_queue_complete(struct mcasp_queue *q, s32 status)
+{
+	struct mcasp_cqe *cqe = &q->cq[q->cq_tail & (MCASP_QUEUE_ENTRIES - 1)];
+
+	cqe->user_data = q->cur.user_data;
+	cqe->status = status;
+	cqe->rx_len = q->rx_done;
+	cqe->start_ns = q->start_ns;
+	cqe->complete_ns = ktime_get_ns();
+
+	q->cq_tail++;
+	smp_store_release(&q->hdr->cq_tail, q->cq_tail);
+	q->busy = false;
+
+	wake_up_interruptible(&q->wait);
+}
+
+static bool mcasp_queue_sqe_valid(const struct mcasp_sqe *sqe)
+{
+	if ((sqe->tx_off | sqe->rx_off) & 3)
+		return false;
+
+	return (u64)sqe->tx_off + (u64)sqe->tx_len * 4 <= MCASP_QUEUE_DATA_SIZE &&
+		(u64)sqe->rx_off + (u64)sqe->rx_len * 4 <= MCASP_QUEUE_DATA_SIZE;
+}
+
+/*
+ * Retire the finished transaction and pick up the next one. A reserved
+ * priority slot would land in the middle of the transaction, new ones are
+ * refused while it is set. in_flight is what sits in both FIFOs, the RX
+ * words it stands for come back before the transaction's own.
+ */
+static void mcasp_queue_advance(struct mcasp_queue *q, bool reserved, u32 in_flight)
+{
+	while (true) {
+		if (q->busy) {
+			if (q->tx_done < q->cur.tx_len || q->rx_done < q->cur.rx_len)
+				return;
+
+			mcasp_queue_complete(q, 0);
+		}
+
+		// no room to post the result
+		if (q->cq_tail - READ_ONCE(q->hdr->cq_head) >= MCASP_QUEUE_ENTRIES)
+			return;
+
+		if (smp_load_acquire(&q->hdr->sq_tail) == q->sq_head)
+			return;
+
+		q->cur = q->sq[q->sq_head & (MCASP_QUEUE_ENTRIES - 1)];
+		q->sq_head++;
+		smp_store_release(&q->hdr->sq_head, q->sq_head);
+
+		q->busy = true;
+		q->tx_done = q->rx_done = q->rx_skipped = q->rx_passed = 0;
+		// with TX data the lead is only known once its first word is out
+		q->rx_lead = q->cur.tx_len ? U32_MAX : in_flight;
+		q->start_ns = ktime_get_ns();
+
+		if (!mcasp_queue_sqe_valid(&q->cur))
+			mcasp_queue_complete(q, -EINVAL);
+		else if (reserved)
+			mcasp_queue_complete(q, -EBUSY);
+	}
+}
+
+/* in_flight counts the FIFO levels and the words staged ahead of this one */
+static inline bool mcasp_queue_tx_word(struct mcasp_queue *q, u32 *val, u32 in_flight)
+{
+	if (!q || !q->busy || q->tx_done >= q->cur.tx_len)
+		return false;
+
+	if (!q->tx_done) {
+		q->rx_lead = in_flight;
+		q->rx_passed = 0;
+	}
+
+	*val = ((u32 *)(q->data + q->cur.tx_off))[q->tx_done++];
+	return true;
+}
+
+static inline bool mcasp_queue_rx_word(struct mcasp_queue *q, u32 val)
+{
+	if (!q || !q->busy || q->rx_done >= q->cur.rx_len)
+		return false;
+
+	if (q->rx_passed < q->rx_lead) {
+		q->rx_passed++;
+		return false;
+	}
+
+	if (q->rx_skipped < q->cur.rx_skip)
+		q->rx_skipped++;
+	else
+		((u32 *)(q->data + q->cur.rx_off))[q->rx_done++] = val;
+
+	return true;
+}
+
+/* raise chip select before the first word of a burst reaches the FIFO */
+static inline void mcasp_burst_tx_words(struct davinci_mcasp *mcasp, u32 count)
+{
+	struct mcasp_burst_state *b = &mcasp->burst_state;
+
+	if (!b->cs_active) {
+		if (mcasp->cs_gpio)
+			gpiod_set_value(mcasp->cs_gpio, 1);
+		b->cs_active = true;
+	}
+	b->tx_words += count;
+
+	// two slot times per word in flight covers the frame sync gaps
+	b->deadline_ns = ktime_get_ns() + MCASP_BURST_CS_SLACK_NS +
+		(u64)(b->tx_words - b->rx_words) * 2 * mcasp->sched.slot_ns;
+}
+
+static inline void mcasp_burst_rx_words(struct davinci_mcasp *mcasp, u32 count)
+{
+	struct mcasp_burst_state *b = &mcasp->burst_state;
+
+	// words outside a window are strays and must not close the next one early
+	if (b->cs_active)
+		b->rx_words = min(b->rx_words + count, b->tx_words);
+}
+
+static void mcasp_burst_close(struct davinci_mcasp *mcasp)
+{
+	struct mcasp_burst_state *b = &mcasp->burst_state;
+
+	if (b->cs_active && mcasp->cs_gpio)
+		gpiod_set_value(mcasp->cs_gpio, 0);
+	b->cs_active = false;
+	b->left = 0;
+	b->tx_words = b->rx_words = 0;
+}
+
+/* worker is parked, marks left from an earlier burst profile no longer match the rings */
+static void mcasp_burst_drop_marks(struct davinci_mcasp *mcasp)
+{
+	int i;
+
+	for (i = 0; i < MCASP_LANES; i++)
+		smp_store_release(&mcasp->tx_marks[i].tail, READ_ONCE(mcasp->tx_marks[i].head));
+}
+
+/*
+ * The transaction is loaded and every word of it has been clocked back in
+ * or had the time to, chip select drops and the next one may start. The
+ * worker polls for this, so the edge trails the last bit by up to a pass.
+ */
+static inline void mcasp_burst_rx_done(struct davinci_mcasp *mcasp, bool burst)
+{
+	struct mcasp_burst_state *b = &mcasp->burst_state;
+
+	if (!b->cs_active || (burst && b->left))
+		return;
+	if (burst && b->rx_words < b->tx_words) {
+		if (ktime_get_ns() < b->deadline_ns)
+			return;
+		dev_dbg(mcasp->dev, "burst window closed with %u of %u words back",
+			b->rx_words, b->tx_words);
+	}
+
+	mcasp_burst_close(mcasp);
+}
+
+/*
+ * Generic netlink, the worker publishes RX blocks, IRQs raise events
+ */
+static struct genl_family mcasp_genl_family;
+
+enum mcasp_genl_groups {
+	MCASP_GENL_GRP_STREAM,
+	MCASP_GENL_GRP_EVENTS,
+};
+
+static void mcasp_genl_rx_flush(struct davinci_mcasp *mcasp)
+{
+	struct mcasp_genl_stream *s = &mcasp->stream;
+	struct sk_buff *skb;
+	void *hdr;
+
+	// nobody subscribed, the block number still advances
+	if (!genl_has_listeners(&mcasp_genl_family, &init_net, MCASP_GENL_GRP_STREAM))
+		goto out;
+
+	skb = genlmsg_new(nla_total_size(s->len * sizeof(u32)) + 64, GFP_KERNEL);
+	if (!skb)
+		goto drop;
+
+	hdr = genlmsg_put(skb, 0, 0, &mcasp_genl_family, 0, MCASP_CMD_RX_BLOCK);
+	if (!hdr ||
+	    nla_put_u32(skb, MCASP_ATTR_SEQ, s->seq) ||
+	    nla_put_u64_64bit(skb, MCASP_ATTR_TIMESTAMP, s->first_ns, MCASP_ATTR_PAD) ||
+	    nla_put_u32(skb, MCASP_ATTR_DROPPED, s->dropped) ||
+	    nla_put(skb, MCASP_ATTR_DATA, s->len * sizeof(u32), s->buf)) {
+		nlmsg_free(skb);
+		goto drop;
+	}
+
+	genlmsg_end(skb, hdr);
+	genlmsg_multicast(&mcasp_genl_family, skb, 0, MCASP_GENL_GRP_STREAM, GFP_KERNEL);
+	goto out;
+
+drop:
+	s->dropped += s->len;
+out:
+	s->seq++;
+	s->len = 0;
+}
+
+static inline void mcasp_genl_rx_word(struct davinci_mcasp *mcasp, u32 val)
+{
+	struct mcasp_genl_stream *s = &mcasp->stream;
+
+	if (!s->len)
+		s->first_ns = ktime_get_ns();
+
+	s->buf[s->len++] = val;
+	if (s->len >= READ_ONCE(s->batch))
+		mcasp_genl_rx_flush(mcasp);
+}
+
+/* safe from hard IRQ, the message is built in event_work */
+static inline void mcasp_event_raise(struct davinci_mcasp *mcasp, int event)
+{
+	if (!mcasp->genl_registered)
+		return;
+
+	set_bit(event, &mcasp->events);
+	schedule_work(&mcasp->event_work);
+}
+
+static void mcasp_extclk_update(struct davinci_mcasp *mcasp, struct mcasp_extclk_dir *d,
+	bool moved, unsigned long now, const char *dir)
+{
+	if (moved) {
+		d->seen = now;
+		if (unlikely(d->lost)) {
+			d->lost = false;
+			dev_info(mcasp->dev, "%s bit clock is back", dir);
+		}
+		return;
+	}
+
+	if (d->lost || time_before(now, d->seen + msecs_to_jiffies(MCASP_EXTCLK_TIMEOUT_MS)))
+		return;
+
+	d->lost = true;
+	mcasp->stats.clock_fails++;
+	mcasp_event_raise(mcasp, MCASP_EVENT_CLOCK_FAIL);
+	dev_warn(mcasp->dev, "no %s bit clock for %u ms", dir, MCASP_EXTCLK_TIMEOUT_MS);
+}
+
+/*
+ * CLKCHK counts against AHCLK, which stays internal with a remote bit
+ * clock, so a stopped remote clock only shows as data no longer moving:
+ * no new RX words, or a TX FIFO that is not drained. The RX level alone
+ * does not do, a few words below the drain threshold stay there for good.
+ */
+static noinline void mcasp_extclk_check(struct davinci_mcasp *mcasp, u32 rfifo, u32 wfifo)
+{
+	struct mcasp_extclk *e = &mcasp->extclk;
+	unsigned long now = jiffies;
+	u64 consumed, arrived;
+
+	if (e->flags & MCASP_PROFILE_RX_EXT_CLK) {
+		arrived = e->rx_drained + rfifo;
+		mcasp_extclk_update(mcasp, &e->rx, arrived != e->rx_arrived, now, "RX");
+		e->rx_arrived = arrived;
+	}
+
+	if (e->flags & MCASP_PROFILE_TX_EXT_CLK) {
+		consumed = mcasp->sched.tx_words - wfifo;
+		mcasp_extclk_update(mcasp, &e->tx, consumed != e->tx_consumed, now, "TX");
+		e->tx_consumed = consumed;
+	}
+}
+
+/*
+ * Worker is about to overwrite this page. If a pipe or a reader still has
+ * it, swap in a fresh page and leave the old one to them.
+ */
+static void mcasp_rx_ring_enter(struct mcasp_rx_ring *ring, u32 seg)
+{
+	struct page *page = ring->pages[seg];
+	struct page *fresh;
+
+	if (page_count(page) > 1) {
+		// must not stall the FIFO poll, without memory overwrite in place
+		fresh = alloc_page(GFP_NOWAIT);
+		if (fresh) {
+			spin_lock(&ring->lock);
+			ring->pages[seg] = fresh;
+			spin_unlock(&ring->lock);
+			put_page(page);
+			page = fresh;
+			ring->flips++;
+		}
+	}
+
+	ring->seg = page_address(page);
+}
+
+static inline void mcasp_rx_ring_put(struct mcasp_rx_ring *ring, u32 pos, u32 val)
+{
+	u32 off = pos & (MCASP_RX_PAGE_WORDS - 1);
+
+	if (unlikely(!off))
+		mcasp_rx_ring_enter(ring, (pos / MCASP_RX_PAGE_WORDS) & (MCASP_RX_RING_PAGES - 1));
+
+	ring->seg[off] = val;
+}
+
+/* count words leaving a lane, tail is where they started */
+static inline void mcasp_tx_lat_check(struct mcasp_tx_lat *lat, int tail, u32 count)
+{
+	u64 ns;
+
+	lat->stats.words += count;
+	if (!smp_load_acquire(&lat->pending) ||
+	    CIRC_CNT(lat->mark, tail, MCASP_TX_BUF_SIZE) > count)
+		return;
+
+	ns = ktime_get_ns() - lat->mark_ns;
+	lat->stats.samples++;
+	lat->stats.last_ns = ns;
+	lat->stats.max_ns = max(lat->stats.max_ns, ns);
+	lat->stats.total_ns += ns;
+	smp_store_release(&lat->pending, false);
+}
+
+/*
+ * Next TX word of the current block. A block is only started once all of
+ * its payload is queued, so a block never stalls half way out.
+ */
+static inline bool mcasp_block_tx_word(struct davinci_mcasp *mcasp, u32 *val)
+{
+	struct mcasp_block_state *b = &mcasp->block;
+	u32 n = b->words, mask, crc, i;
+
+	if (b->tx_pos) {
+		*val = b->tx_stage[b->tx_pos - 1];
+		if (++b->tx_pos == n + 4) {
+			b->tx_pos = 0;
+			b->stats.tx_blocks++;
+		}
+		return true;
+	}
+
+	if (CIRC_CNT(mcasp->tx_buf.head, mcasp->tx_buf.tail, MCASP_TX_BUF_SIZE) < n)
+		return false;
+
+	// the CRC covers what the receiver sees, not the masked off bits
+	mask = mcasp_get_reg(mcasp, DAVINCI_MCASP_XMASK_REG);
+	b->tx_stage[0] = b->tx_seq++ << 16;
+	mcasp_tx_lat_check(&mcasp->tx_lat[MCASP_LANE_BULK], mcasp->tx_buf.tail, n);
+	for (i = 1; i <= n; i++) {
+		b->tx_stage[i] = mcasp->tx_buf.buf[mcasp->tx_buf.tail] & mask;
+		mcasp->tx_buf.tail = (mcasp->tx_buf.tail + 1) & (MCASP_TX_BUF_SIZE - 1);
+	}
+
+	crc = crc32_le(~0, (u8 *)b->tx_stage, (n + 1) * sizeof(u32)) ^ ~0;
+	b->tx_stage[n + 1] = crc & 0xFFFF0000;
+	b->tx_stage[n + 2] = crc << 16;
+
+	*val = MCASP_BLOCK_SYNC;
+	b->tx_pos = 1;
+	return true;
+}
+
+/* verify a complete block and pass its payload on, returns the new ring head */
+static u32 mcasp_block_rx_done(struct davinci_mcasp *mcasp, u32 rx_head)
+{
+	struct mcasp_block_state *b = &mcasp->block;
+	u32 n = b->words, crc, seq, i;
+
+	crc = crc32_le(~0, (u8 *)b->rx_stage, (n + 1) * sizeof(u32)) ^ ~0;
+	if (crc != ((b->rx_stage[n + 1] & 0xFFFF0000) | (b->rx_stage[n + 2] >> 16))) {
+		b->stats.crc_errors++;
+		return rx_head;
+	}
+
+	seq = b->rx_stage[0] >> 16;
+	if (b->rx_synced && seq != b->rx_seq)
+		b->stats.seq_gaps += (seq - b->rx_seq) & 0xFFFF;
+	b->rx_seq = (seq + 1) & 0xFFFF;
+	b->rx_synced = true;
+	b->stats.rx_blocks++;
+
+	for (i = 1; i <= n; i++)
+		mcasp_rx_ring_put(&mcasp->rx_ring, rx_head++, b->rx_stage[i]);
+
+	return rx_head;
+}
+
+static inline u32 mcasp_block_rx_word(struct davinci_mcasp *mcasp, u32 val, u32 rx_head)
+{
+	struct mcasp_block_state *b = &mcasp->block;
+
+	if (!b->rx_pos) {
+		// hunting, everything between blocks is filler
+		if (val == MCASP_BLOCK_SYNC) {
+			b->rx_mask = mcasp_get_reg(mcasp, DAVINCI_MCASP_RMASK_REG);
+			b->rx_pos = 1;
+		}
+		return rx_head;
+	}
+
+	b->rx_stage[b->rx_pos++ - 1] = val & b->rx_mask;
+	if (b->rx_pos < b->words + 4)
+		return rx_head;
+
+	b->rx_pos = 0;
+	return mcasp_block_rx_done(mcasp, rx_head);
+}
+
+/*
+ * RSLOT is the slot being shifted in, so the newest FIFO word belongs to the
+ * last active slot before it and counting back by the FIFO level gives the
+ * slot of the oldest one. RSLOT is sampled on both sides of the level read,
+ * if a slot ended in between the next pass tries again.
+ */
+static bool mcasp_frame_align(struct davinci_mcasp *mcasp)
+{
+	struct mcasp_frame_state *f = &mcasp->frame;
+	const struct mcasp_profile *p = &mcasp->profiles[mcasp->cur_profile].cfg;
+	u32 slot, level, before;
+
+	slot = mcasp_get_reg(mcasp, DAVINCI_MCASP_RSLOT_REG) & 0x3FF;
+	level = mcasp_get_reg(mcasp, MCASP_RFIFOSTS_REG);
+	if ((mcasp_get_reg(mcasp, DAVINCI_MCASP_RSLOT_REG) & 0x3FF) != slot || slot >= p->slots)
+		return false;
+
+	f->slot_mask = p->slot_mask;
+	f->words = hweight32(p->slot_mask);
+	before = hweight32(p->slot_mask & (BIT(slot) - 1));
+	f->pos = (before + f->words - level % f->words) % f->words;
+
+	// the words up to the next frame start are dropped
+	f->broken = f->pos != 0;
+	f->resync = true;
+	f->aligned = true;
+	f->stats.resyncs++;
+
+	return true;
+}
+
+/* realigns after anything that may have cost words, false while the phase is unknown */
+static bool mcasp_frame_check(struct davinci_mcasp *mcasp)
+{
+	struct mcasp_frame_state *f = &mcasp->frame;
+	u32 errors = READ_ONCE(mcasp->stats.rx_overruns) + READ_ONCE(mcasp->stats.sync_errors);
+
+	if (unlikely(errors != f->errors)) {
+		f->errors = errors;
+		f->aligned = false;
+	}
+
+	return f->aligned || mcasp_frame_align(mcasp);
+}
+
+/* keep is false for words taken by someone else, their frame is dropped */
+static inline u32 mcasp_frame_rx_word(struct davinci_mcasp *mcasp, u32 val, u32 rx_head, bool keep)
+{
+	struct mcasp_frame_state *f = &mcasp->frame;
+	u32 i, flags;
+
+	if (!keep)
+		f->broken = true;
+	if (f->broken)
+		f->stats.dropped_words++;
+
+	f->stage[f->pos] = val;
+	if (++f->pos < f->words)
+		return rx_head;
+
+	f->pos = 0;
+	if (f->broken) {
+		f->broken = false;
+		return rx_head;
+	}
+
+	flags = f->resync ? MCASP_FRAME_RESYNC : 0;
+	f->resync = false;
+	f->stats.frames++;
+
+	if (f->latest_users) {
+		// readers spin while the count is odd, do not get preempted here
+		preempt_disable();
+		write_seqcount_begin(&f->latest_seq);
+		f->latest.frame++;
+		f->latest.timestamp_ns = ktime_get_ns();
+		f->latest.words = f->words;
+		f->latest.flags = flags;
+		memcpy(f->latest.data, f->stage, f->words * sizeof(u32));
+		write_seqcount_end(&f->latest_seq);
+		preempt_enable();
+	}
+
+	if (!f->enabled)
+		return rx_head;
+
+	mcasp_rx_ring_put(&mcasp->rx_ring, rx_head++, MCASP_FRAME_SYNC | flags);
+	for (i = 0; i < f->words; i++)
+		mcasp_rx_ring_put(&mcasp->rx_ring, rx_head++, f->stage[i]);
+
+	return rx_head;
+}
+
+/* compensator at the output rate, hist is a circular delay line */
+static inline s32 mcasp_decim_fir(struct mcasp_decim *d, s32 x)
+{
+	u32 taps = d->cfg.fir_taps;
+	u32 i = d->hist_pos;
+	s64 acc = 0;
+	u32 k;
+
+	d->hist[i] = x;
+	d->hist_pos = i + 1 == taps ? 0 : i + 1;
+
+	for (k = 0; k < taps; k++) {
+		acc += (s64)d->cfg.fir[k] * d->hist[i];
+		i = i ? i - 1 : taps - 1;
+	}
+
+	acc >>= d->cfg.fir_shift;
+	if (unlikely(acc > S32_MAX || acc < S32_MIN)) {
+		d->stats.clipped++;
+		return acc > 0 ? S32_MAX : S32_MIN;
+	}
+
+	return acc;
+}
+
+/* the integrators wrap, the comb output is exact while it fits in 32 bits */
+static inline u32 mcasp_decim_rx_word(struct davinci_mcasp *mcasp, u32 val, u32 rx_head)
+{
+	struct mcasp_decim *d = &mcasp->decim;
+	u32 order = d->cfg.order;
+	u32 x, prev, j;
+	int b;
+
+	d->stats.in_words++;
+
+	for (b = 31; b >= 0; b--) {
+		x = (val >> b) & 1 ? 1 : -1;
+		for (j = 0; j < order; j++)
+			x = d->integ[j] += x;
+
+		if (--d->phase)
+			continue;
+		d->phase = d->cfg.ratio;
+
+		for (j = 0; j < order; j++) {
+			prev = d->comb[j];
+			d->comb[j] = x;
+			x -= prev;
+		}
+
+		x = (s32)x >> d->cfg.shift;
+		if (d->cfg.fir_taps)
+			x = mcasp_decim_fir(d, x);
+
+		mcasp_rx_ring_put(&mcasp->rx_ring, rx_head++, x);
+		d->stats.out_samples++;
+	}
+
+	return rx_head;
+}
+
+/* words loaded into XBUF, keeps the frame count in step with the wire */
+static inline void mcasp_sched_count(struct mcasp_sched *s, u32 count)
+{
+	s->tx_words += count;
+	if (unlikely(!s->words_per_frame))
+		return;
+
+	s->frame_pos += count;
+	while (s->frame_pos >= s->words_per_frame) {
+		s->frame_pos -= s->words_per_frame;
+		s->tx_frame++;
+	}
+}
+
+/* while blocks wait, a run must not cross the frame boundary they may start at */
+static inline u32 mcasp_sched_run_limit(struct mcasp_sched *s, u32 max)
+{
+	if (READ_ONCE(s->queued) && s->words_per_frame)
+		return min(max, s->words_per_frame - s->frame_pos);
+
+	return max;
+}
+
+/* ...and before the slot reserved for the priority lane */
+static inline u32 mcasp_tx_run_limit(struct davinci_mcasp *mcasp, int prio_slot, u32 max)
+{
+	struct mcasp_sched *s = &mcasp->sched;
+
+	max = mcasp_sched_run_limit(s, max);
+	if (prio_slot >= 0 && s->words_per_frame)
+		max = min(max, (prio_slot + s->words_per_frame - s->frame_pos) % s->words_per_frame);
+
+	return max;
+}
+
+static inline bool mcasp_prio_slot_due(struct davinci_mcasp *mcasp, int prio_slot)
+{
+	return prio_slot >= 0 && mcasp->sched.words_per_frame &&
+		mcasp->sched.frame_pos == prio_slot;
+}
+
+/* contiguous part of a TX ring, up to max words, with one tail update */
+static inline u32 mcasp_tx_ring_run(struct mycirc_buf *tx, struct mcasp_tx_lat *lat,
+	u32 *dst, u32 max)
+{
+	int head = smp_load_acquire(&tx->head);
+	u32 run;
+
+	run = min_t(u32, CIRC_CNT_TO_END(head, tx->tail, MCASP_TX_BUF_SIZE), max);
+	if (!run)
+		return 0;
+
+	memcpy(dst, &tx->buf[tx->tail], run * sizeof(u32));
+	mcasp_tx_lat_check(lat, tx->tail, run);
+	smp_store_release(&tx->tail, (tx->tail + run) & (MCASP_TX_BUF_SIZE - 1));
+
+	return run;
+}
+
+static inline u32 mcasp_tx_buf_run(struct davinci_mcasp *mcasp, u32 *dst, u32 max)
+{
+	return mcasp_tx_ring_run(&mcasp->tx_buf, &mcasp->tx_lat[MCASP_LANE_BULK], dst, max);
+}
+
+static noinline void mcasp_pattern_swap(struct mcasp_pattern_state *p)
+{
+	struct mcasp_pattern_buf *next = xchg(&p->next, NULL);
+
+	vfree(p->cur);
+	if (!next->words) {
+		vfree(next);
+		next = NULL;
+	}
+
+	p->cur = next;
+	p->stats.words = next ? next->words : 0;
+	p->stats.swaps++;
+}
+
+/* idle words, a loaded pattern only takes over at the wrap of the current one */
+static inline u32 mcasp_pattern_run(struct mcasp_pattern_state *p, u32 *dst, u32 max)
+{
+	struct mcasp_pattern_buf *cur = p->cur;
+	u32 run;
+
+	if (unlikely(!cur || p->pos == cur->words)) {
+		if (READ_ONCE(p->next))
+			mcasp_pattern_swap(p);
+		p->pos = 0;
+		cur = p->cur;
+		if (!cur)
+			return 0;
+	}
+
+	run = min(max, cur->words - p->pos);
+	memcpy(dst, &cur->data[p->pos], run * sizeof(u32));
+	p->pos += run;
+	if (p->pos == cur->words)
+		p->stats.loops++;
+
+	return run;
+}
+
+/* priority words go first, but never into the middle of a framed sequence */
+static inline u32 mcasp_prio_run(struct davinci_mcasp *mcasp, struct mcasp_queue *q,
+	u32 *dst, u32 max)
+{
+	if (READ_ONCE(mcasp->prio_buf.head) == mcasp->prio_buf.tail)
+		return 0;
+	if ((q && q->busy && q->tx_done && q->tx_done < q->cur.tx_len) ||
+	    mcasp->sched.cur || mcasp->block.tx_pos)
+		return 0;
+
+	return mcasp_tx_ring_run(&mcasp->prio_buf, &mcasp->tx_lat[MCASP_LANE_PRIO], dst, max);
+}
+
+/* next words of the current client request, completes it when drained */
+static u32 mcasp_client_tx_run(struct mcasp_client_state *c, u32 *dst, u32 max)
+{
+	struct mcasp_tx_req *req = c->cur;
+	unsigned long flags;
+	u32 run;
+
+	if (!req) {
+		if (list_empty_careful(&c->tx_queue))
+			return 0;
+
+		spin_lock_irqsave(&c->lock, flags);
+		req = list_first_entry_or_null(&c->tx_queue, struct mcasp_tx_req, node);
+		if (req)
+			list_del_init(&req->node);
+		spin_unlock_irqrestore(&c->lock, flags);
+		if (!req)
+			return 0;
+		c->cur = req;
+	}
+
+	run = min_t(u32, req->words - req->pos, max);
+	memcpy(dst, req->buf + req->pos, run * sizeof(u32));
+	req->pos += run;
+
+	if (req->pos == req->words) {
+		c->cur = NULL;
+		if (req->complete)
+			req->complete(req, 0);
+	}
+
+	return run;
+}
+
+/* words of the oldest write() on a lane, words written without a mark go as one */
+static u32 mcasp_burst_ring_len(struct mycirc_buf *tx, struct mcasp_tx_marks *m)
+{
+	u32 mhead = smp_load_acquire(&m->head);
+	u32 avail = CIRC_CNT(smp_load_acquire(&tx->head), tx->tail, MCASP_TX_BUF_SIZE);
+	u32 tail = m->tail, len = avail;
+
+	while (tail != mhead) {
+		len = CIRC_CNT(m->end[tail++ & (MCASP_TX_MARKS - 1)], tx->tail, MCASP_TX_BUF_SIZE);
+		if (len && len <= avail)
+			break;
+		len = avail;
+	}
+	smp_store_release(&m->tail, tail);
+
+	return len;
+}
+
+/* length of the next transaction of the source, U32_MAX if it ends itself, 0 if idle */
+static u32 mcasp_burst_len(struct davinci_mcasp *mcasp, struct mcasp_queue *q)
+{
+	switch (mcasp->burst_state.src) {
+	case MCASP_BURST_PRIO:
+		return mcasp_burst_ring_len(&mcasp->prio_buf, &mcasp->tx_marks[MCASP_LANE_PRIO]);
+	case MCASP_BURST_QUEUE:
+		return q && q->busy ? q->cur.tx_len - q->tx_done : 0;
+	case MCASP_BURST_CLIENT:
+		return U32_MAX;
+	case MCASP_BURST_BLOCK:
+		return mcasp->block.words ? U32_MAX : 0;
+	case MCASP_BURST_BULK:
+		// with a block size tx_buf only leaves in blocks
+		return mcasp->block.words ? 0 :
+			mcasp_burst_ring_len(&mcasp->tx_buf, &mcasp->tx_marks[MCASP_LANE_BULK]);
+	default:
+		return 0;
+	}
+}
+
+static u32 mcasp_burst_load(struct davinci_mcasp *mcasp, struct mcasp_queue *q,
+	u32 *dst, u32 max, u32 in_flight)
+{
+	struct mcasp_burst_state *b = &mcasp->burst_state;
+	u32 n = 0;
+
+	max = min(max, b->left);
+	switch (b->src) {
+	case MCASP_BURST_PRIO:
+		n = mcasp_tx_ring_run(&mcasp->prio_buf, &mcasp->tx_lat[MCASP_LANE_PRIO], dst, max);
+		n += mcasp_tx_ring_run(&mcasp->prio_buf, &mcasp->tx_lat[MCASP_LANE_PRIO], dst + n, max - n);
+		break;
+	case MCASP_BURST_QUEUE:
+		while (n < max && mcasp_queue_tx_word(q, &dst[n], in_flight + n))
+			n++;
+		break;
+	case MCASP_BURST_CLIENT:
+		n = mcasp_client_tx_run(&mcasp->client, dst, max);
+		if (n && !mcasp->client.cur)
+			b->left = n;
+		break;
+	case MCASP_BURST_BLOCK:
+		while (n < max && mcasp_block_tx_word(mcasp, &dst[n])) {
+			n++;
+			// last word of the block
+			if (!mcasp->block.tx_pos) {
+				b->left = n;
+				break;
+			}
+		}
+		break;
+	case MCASP_BURST_BULK:
+		n = mcasp_tx_buf_run(mcasp, dst, max);
+		n += mcasp_tx_buf_run(mcasp, dst + n, max - n);
+		break;
+	default:
+		break;
+	}
+
+	if (b->left != U32_MAX)
+		b->left -= n;
+
+	return n;
+}
+
+/*
+ * Burst mode loads one transaction per chip select window: a write(), a
+ * queue entry, a client request or a block. The next one is held back
+ * until mcasp_burst_rx_done() has closed the window of the current one.
+ * in_flight is passed on to queue entries, see mcasp_queue_tx_word().
+ */
+static u32 mcasp_burst_stage(struct davinci_mcasp *mcasp, struct mcasp_queue *q,
+	u32 *dst, u32 max, u32 in_flight)
+{
+	struct mcasp_burst_state *b = &mcasp->burst_state;
+	u32 n;
+
+	if (b->cs_active)
+		return b->left ? mcasp_burst_load(mcasp, q, dst, max, in_flight) : 0;
+
+	// no window open, the first source with words starts the next one
+	for (b->src = 0; b->src < MCASP_BURST_SOURCES; b->src++) {
+		b->left = mcasp_burst_len(mcasp, q);
+		if (b->left && (n = mcasp_burst_load(mcasp, q, dst, max, in_flight)))
+			return n;
+	}
+	b->left = 0;
+
+	return 0;
+}
+
+/* at a frame boundary, take the head of the queue if its frame has come */
+static bool mcasp_sched_pop(struct mcasp_sched *s)
+{
+	struct mcasp_sched_entry *e;
+
+	spin_lock(&s->lock);
+	e = list_first_entry_or_null(&s->queue, struct mcasp_sched_entry, node);
+	if (e && e->frame <= s->tx_frame) {
+		list_del(&e->node);
+		s->queued--;
+	} else {
+		e = NULL;
+	}
+	spin_unlock(&s->lock);
+
+	if (!e)
+		return false;
+
+	if (e->frame < s->tx_frame)
+		s->status.late++;
+	s->status.released++;
+	s->status.last_frame = e->frame;
+
+	s->cur = e;
+	s->pos = 0;
+	s->measuring = true;
+	s->measure_word = s->tx_words;
+	s->measure_target = e->target_ns;
+	return true;
+}
+
+static inline bool mcasp_sched_tx_word(struct mcasp_sched *s, u32 *val)
+{
+	if (!s->cur &&
+	    (s->frame_pos || !READ_ONCE(s->queued) || !mcasp_sched_pop(s)))
+		return false;
+
+	*val = s->cur->data[s->pos++];
+	if (s->pos == s->cur->words) {
+		kfree(s->cur);
+		s->cur = NULL;
+	}
+	return true;
+}
+
+/*
+ * The first word of the block has left the FIFO. XSLOT tells how far into
+ * the frame the serializer is, which gives the start of the frame.
+ */
+static void mcasp_sched_measure(struct davinci_mcasp *mcasp)
+{
+	struct mcasp_sched *s = &mcasp->sched;
+	u32 slot = mcasp_get_reg(mcasp, DAVINCI_MCASP_XSLOT_REG) & 0x3FF;
+	s64 err = (s64)(ktime_get_ns() - slot * s->slot_ns - s->measure_target);
+
+	s->status.last_error_ns = err;
+	s->status.max_error_ns = max_t(u64, s->status.max_error_ns, abs(err));
+	s->measuring = false;
+}
+
+/* take over a configuration posted by mcasp_capture_arm */
+static void mcasp_capture_adopt(struct mcasp_capture_state *c)
+{
+	c->seq = smp_load_acquire(&c->req_seq);
+	c->cfg = c->req;
+	c->size = c->cfg.pre_words + c->cfg.post_words;
+	c->idx = c->count = 0;
+
+	WRITE_ONCE(c->state, c->cfg.trigger == MCASP_TRIGGER_OFF ?
+		MCASP_CAPTURE_IDLE : MCASP_CAPTURE_ARMED);
+}
+
+/* rolling window while armed, frozen once post_words are in */
+static inline void mcasp_capture_word(struct mcasp_capture_state *c, u32 val)
+{
+	if (c->state == MCASP_CAPTURE_DONE)
+		return;
+
+	c->buf[c->idx] = val;
+	if (++c->idx == c->size)
+		c->idx = 0;
+	c->count++;
+
+	if (c->state == MCASP_CAPTURE_ARMED) {
+		if (!READ_ONCE(c->fire) && (c->cfg.trigger != MCASP_TRIGGER_MATCH ||
+		    (val & c->cfg.match_mask) != c->cfg.match_value))
+			return;
+
+		if (!READ_ONCE(c->fire))
+			c->trigger_ns = ktime_get_ns();
+		WRITE_ONCE(c->fire, false);
+		c->trigger_word = val;
+		c->pre_avail = min(c->count - 1, c->cfg.pre_words);
+		c->post_left = c->cfg.post_words;
+		c->state = MCASP_CAPTURE_TRIGGERED;
+	}
+
+	if (--c->post_left == 0) {
+		smp_store_release(&c->state, MCASP_CAPTURE_DONE);
+		wake_up_interruptible(&c->wait);
+	}
+}
+
+static int mcasp_worker(void *data) {
+	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
+	struct mcasp_selftest_state *st = &mcasp->selftest;
+	u32 wfifo, rfifo;
+	u32 tx[FIFO_BATCH], rx[FIFO_BATCH];
+	u32 val, run, got;
+	bool selftest, burst, stream, capture, block, framed, decim;
+	struct mcasp_queue *q;
+	u32 rx_head;
+	int tx_ser, rx_ser, prio_slot;
+	int i, n;
+
+	while(!kthread_should_stop()) {
+		if (kthread_should_park())
+			kthread_parkme();
+
+		prio_slot = mcasp->prio_slot;
+		q = READ_ONCE(mcasp->queue);
+
+		tx_ser = READ_ONCE(mcasp->tx_ser);
+		rx_ser = READ_ONCE(mcasp->rx_ser);
+		burst = READ_ONCE(mcasp->burst);
+		block = mcasp->block.words != 0;
+		framed = mcasp->frame.enabled || mcasp->frame.latest_users;
+		decim = mcasp->decim.cfg.ratio != 0;
+		stream = READ_ONCE(mcasp->stream.enabled);
+		if (unlikely(READ_ONCE(mcasp->capture.req_seq) != mcasp->capture.seq))
+			mcasp_capture_adopt(&mcasp->capture);
+		capture = mcasp->capture.state != MCASP_CAPTURE_IDLE;
+		if (unlikely(!stream && mcasp->stream.len))
+			mcasp->stream.len = 0;
+		selftest = READ_ONCE(st->active);
+		if (unlikely(selftest && READ_ONCE(st->stop))) {
+			WRITE_ONCE(st->active, false);
+			complete(&st->done);
+			selftest = false;
+		}
+
+		wfifo = mcasp_get_reg(mcasp, MCASP_WFIFOSTS_REG);
+		rfifo = mcasp_get_reg(mcasp, MCASP_RFIFOSTS_REG);
+		dev_dbg(mcasp->dev, "WFIFO: 0x%08X, RFIFO: 0x%08X", wfifo, rfifo);
+
+		if (q)
+			mcasp_queue_advance(q, prio_slot >= 0, wfifo + rfifo);
+
+		if (unlikely(mcasp->extclk.flags))
+			mcasp_extclk_check(mcasp, rfifo, wfifo);
+
+		if (unlikely(mcasp->sched.measuring) &&
+		    mcasp->sched.tx_words - wfifo > mcasp->sched.measure_word)
+			mcasp_sched_measure(mcasp);
+
+		if (unlikely(mcasp->first_frame_pending) && rfifo) {
+			mcasp->stats.first_frame_ns = ktime_to_ns(ktime_sub(ktime_get(), mcasp->start_time));
+			mcasp->first_frame_pending = false;
+		}
+
+
+		// stage the batch, then push it through the data port in one go
+		if (burst && !selftest && wfifo <= (FIFO_DEPTH - FIFO_BATCH)) {
+			n = mcasp_burst_stage(mcasp, q, tx, FIFO_BATCH, wfifo + rfifo);
+			if (n) {
+				mcasp_sched_count(&mcasp->sched, n);
+				mcasp_burst_tx_words(mcasp, n);
+				mcasp_write_dat_rep(mcasp, DAVINCI_MCASP_XBUF_REG(tx_ser), tx, n);
+			}
+		} else if(wfifo <= (FIFO_DEPTH - FIFO_BATCH)) {
+			for(n = 0; n < FIFO_BATCH; n += run) {
+				run = 1;
+				if (unlikely(selftest)) {
+					tx[n] = mcasp_prbs_next(&st->tx_lfsr) << PRBS_SHIFT;
+					st->tx_words++;
+				} else if (unlikely(mcasp_prio_slot_due(mcasp, prio_slot))) {
+					// reserved slot, nothing but priority words and filler
+					if (!mcasp_tx_ring_run(&mcasp->prio_buf,
+							&mcasp->tx_lat[MCASP_LANE_PRIO], &tx[n], 1))
+						tx[n] = TX_FILLER;
+				} else if (prio_slot < 0 && (got = mcasp_prio_run(mcasp, q, &tx[n],
+						mcasp_tx_run_limit(mcasp, prio_slot, FIFO_BATCH - n)))) {
+					// control words overtake everything queued
+					run = got;
+				} else if (mcasp_queue_tx_word(q, &tx[n], wfifo + rfifo + n)) {
+					// transaction data goes first
+				} else if (mcasp_sched_tx_word(&mcasp->sched, &tx[n])) {
+					// release frame reached
+				} else if ((got = mcasp_client_tx_run(&mcasp->client, &tx[n],
+						mcasp_tx_run_limit(mcasp, prio_slot, FIFO_BATCH - n)))) {
+					// in-kernel client buffers
+					run = got;
+				} else if (unlikely(block)) {
+					if (!mcasp_block_tx_word(mcasp, &tx[n])) {
+						if (burst)
+							break;
+						tx[n] = TX_FILLER;
+					}
+				} else if ((got = mcasp_tx_buf_run(mcasp, &tx[n],
+						mcasp_tx_run_limit(mcasp, prio_slot, FIFO_BATCH - n)))) {
+					run = got;
+					dev_dbg(mcasp->dev, "wrote %u words, first 0x%08X", run, tx[n]);
+				} else if (burst) {
+					// no idle frames in burst mode
+					break;
+				} else if ((got = mcasp_pattern_run(&mcasp->pattern, &tx[n],
+						mcasp_tx_run_limit(mcasp, prio_slot, FIFO_BATCH - n)))) {
+					run = got;
+				} else {
+					run = mcasp_tx_run_limit(mcasp, prio_slot, FIFO_BATCH - n);
+					for (i = n; i < n + run; i++)
+						tx[i] = TX_FILLER;
+				}
+				mcasp_sched_count(&mcasp->sched, run);
+			}
+
+			if (n) {
+				if (burst)
+					mcasp_burst_tx_words(mcasp, n);
+				mcasp_write_dat_rep(mcasp, DAVINCI_MCASP_XBUF_REG(tx_ser), tx, n);
+			}
+		}
+
+		// bursts can be shorter than the FIFO threshold, drain what is there
+		if (burst)
+			n = min_t(u32, rfifo, FIFO_BATCH);
+		else
+			n = rfifo >= FIFO_BATCH ? FIFO_BATCH : 0;
+
+		if (unlikely(framed) && n && !mcasp_frame_check(mcasp))
+			n = 0;
+
+		if(n) {
+			mcasp_read_dat_rep(mcasp, DAVINCI_MCASP_RBUF_REG(rx_ser), rx, n);
+			mcasp->extclk.rx_drained += n;
+			if (burst)
+				mcasp_burst_rx_words(mcasp, n);
+			if (mcasp->client.rx_handler && !selftest)
+				mcasp->client.rx_handler(mcasp->client.rx_context, rx, n);
+
+			rx_head = mcasp->rx_ring.head;
+			for(i = 0; i < n; i++) {
+				val = rx[i];
+				if (unlikely(selftest)) {
+					mcasp_selftest_check(st, val);
+					if (unlikely(framed))
+						rx_head = mcasp_frame_rx_word(mcasp, val, rx_head, false);
+				} else if (mcasp_queue_rx_word(q, val)) {
+					// consumed by the transaction, its frame is lost to readers
+					if (unlikely(framed))
+						rx_head = mcasp_frame_rx_word(mcasp, val, rx_head, false);
+				} else {
+					if (unlikely(capture))
+						mcasp_capture_word(&mcasp->capture, val);
+					if (unlikely(stream))
+						mcasp_genl_rx_word(mcasp, val);
+					// overwrites the oldest word, slow readers find out in read()
+					if (unlikely(block)) {
+						rx_head = mcasp_block_rx_word(mcasp, val, rx_head);
+					} else if (unlikely(decim)) {
+						rx_head = mcasp_decim_rx_word(mcasp, val, rx_head);
+					} else {
+						if (unlikely(framed))
+							rx_head = mcasp_frame_rx_word(mcasp, val, rx_head, true);
+						// frame aligned readers only get whole frames, idle filler is dropped
+						if(likely(!mcasp->frame.enabled && val != TX_FILLER))
+							mcasp_rx_ring_put(&mcasp->rx_ring, rx_head++, val);
+					}
+				}
+			}
+			smp_store_release(&mcasp->rx_ring.head, rx_head);
+		}
+
+		if (unlikely(mcasp->burst_state.cs_active))
+			mcasp_burst_rx_done(mcasp, burst);
+
+		schedule();
+	}
+
+	return 0;
+}
+
+static irqreturn_t mcasp_tx_irq_handler(int irq, void *data)
+{
+	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
+	u32 handled_mask = 0;
+	u32 stat;
+
+	stat = mcasp_get_reg(mcasp, DAVINCI_MCASP_XSTAT_REG);
+
+	if (unlikely(stat & XRDMAERR)) {
+		dev_err_ratelimited(mcasp->dev, "XDMAERR");
+		handled_mask |= XRDMAERR;
+	}
+
+	if (unlikely(stat & XUNDRN)) {
+		mcasp->stats.tx_underruns++;
+		mcasp_event_raise(mcasp, MCASP_EVENT_UNDERRUN);
+		dev_err_ratelimited(mcasp->dev, "XUNDRN");
+		handled_mask |= XUNDRN;
+	}
+
+	if (unlikely(stat & XRCKFAIL)) {
+		mcasp->stats.clock_fails++;
+		mcasp_event_raise(mcasp, MCASP_EVENT_CLOCK_FAIL);
+		dev_err_ratelimited(mcasp->dev, "XCKFAIL");
+		handled_mask |= XRCKFAIL;
+	}
+
+	if (unlikely(stat & XRSYNCERR)) {
+		mcasp->stats.sync_errors++;
+		mcasp_event_raise(mcasp, MCASP_EVENT_SYNC_ERROR);
+		dev_err_ratelimited(mcasp->dev, "XSYNCERR");
+		handled_mask |= XRSYNCERR;
+	}
+
+	if (unlikely(stat & XRERR)) {
+		dev_err_ratelimited(mcasp->dev, "XERR 0x%08X", stat);
+		mcasp_clear_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG);
+		mcasp_event_raise(mcasp, MCASP_EVENT_LINK_DOWN);
+		schedule_delayed_work(&mcasp->recover_work, msecs_to_jiffies(MCASP_RECOVER_MS));
+		handled_mask |= XRERR;
+	}
+
+	/* Ack the handled event only */
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, handled_mask);
+
+	// local_irq_restore(flags);
+	return IRQ_RETVAL(handled_mask);
+}
+
+static irqreturn_t mcasp_rx_irq_handler(int irq, void *data)
+{
+	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
+	u32 handled_mask = 0;
+	u32 stat;
+
+	stat = mcasp_get_reg(mcasp, DAVINCI_MCASP_RSTAT_REG);
+
+	if (unlikely(stat & ROVRN)) {
+		mcasp->stats.rx_overruns++;
+		mcasp_event_raise(mcasp, MCASP_EVENT_OVERRUN);
+		dev_err_ratelimited(mcasp->dev, "ROVRN");
+		handled_mask |= ROVRN;
+	}
+
+	if (unlikely(stat & XRDMAERR)) {
+		dev_err_ratelimited(mcasp->dev, "RDMAERR");
+		handled_mask |= XRDMAERR;
+	}
+
+	if (unlikely(stat & XRCKFAIL)) {
+		mcasp->stats.clock_fails++;
+		mcasp_event_raise(mcasp, MCASP_EVENT_CLOCK_FAIL);
+		dev_err_ratelimited(mcasp->dev, "RCKFAIL");
+		handled_mask |= XRCKFAIL;
+	}
+
+	if (unlikely(stat & XRSYNCERR)) {
+		mcasp->stats.sync_errors++;
+		mcasp_event_raise(mcasp, MCASP_EVENT_SYNC_ERROR);
+		dev_err_ratelimited(mcasp->dev, "RSYNCERR");
+		handled_mask |= XRSYNCERR;
+	}
+
+	if (unlikely(stat & XRERR)) {
+		dev_err_ratelimited(mcasp->dev, "RERR 0x%08X", stat);
+		mcasp_clear_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG);
+		mcasp_event_raise(mcasp, MCASP_EVENT_LINK_DOWN);
+		schedule_delayed_work(&mcasp->recover_work, msecs_to_jiffies(MCASP_RECOVER_MS));
+		handled_mask |= XRERR;
+	}
+
+	/* Ack the handled event only */
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, handled_mask);
+
+	// local_irq_restore(flags);
+	return IRQ_RETVAL(handled_mask);
+}
+
+static irqreturn_t mcasp_trigger_irq_handler(int irq, void *data)
+{
+	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
+	struct mcasp_capture_state *c = &mcasp->capture;
+
+	if (READ_ONCE(c->state) != MCASP_CAPTURE_ARMED || READ_ONCE(c->fire))
+		return IRQ_HANDLED;
+
+	c->trigger_ns = ktime_get_ns();
+	smp_wmb();
+	WRITE_ONCE(c->fire, true);
+
+	return IRQ_HANDLED;
+}
+
+static void mcasp_rx_init(struct davinci_mcasp *mcasp, const struct mcasp_dir_regs *regs) {
+
+	// mask bits
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_RMASK_REG, regs->mask);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RMASK_REG);
+
+	// format bits
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_RFMT_REG, regs->fmt);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RFMT_REG);
+
+	// frame sync
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_AFSRCTL_REG, regs->afsctl);
+	REG_DUMP(mcasp, DAVINCI_MCASP_AFSRCTL_REG);
+
+	// bit clock setup
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_ACLKRCTL_REG, regs->aclkctl);
+	REG_DUMP(mcasp, DAVINCI_MCASP_ACLKRCTL_REG);
+
+	// high clock
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_AHCLKRCTL_REG, regs->ahclkctl);
+	REG_DUMP(mcasp, DAVINCI_MCASP_AHCLKRCTL_REG);
+
+	// ROVRN interrupt eanble
+	mcasp_set_bits(mcasp, DAVINCI_MCASP_RINTCTL_REG, ROVRN | RSYNCERR | RCKFAIL | RDMAERR);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RINTCTL_REG);
+
+	// clock check
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_RCLKCHK_REG, regs->clkchk);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RCLKCHK_REG);
+
+	// set TDM
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_RTDM_REG, regs->tdm);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RTDM_REG);
+
+	mcasp_clr_bits(mcasp, MCASP_RFIFOCTL_REG, FIFO_ENABLE);
+	// NUMDMA must be equal to number of serielizer or DMAERR
+	// NUMEVT think it is not important
+	mcasp_mod_bits(mcasp, MCASP_RFIFOCTL_REG, NUMDMA(0x1) | NUMEVT(0x6), NUMDMA_MASK | NUMEVT_MASK);
+	mcasp_set_bits(mcasp, MCASP_RFIFOCTL_REG, FIFO_ENABLE);
+
+	return;
+}
+
+static void mcasp_tx_init(struct davinci_mcasp *mcasp, const struct mcasp_dir_regs *regs) {
+
+	// mask
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_XMASK_REG, regs->mask);
+	REG_DUMP(mcasp, DAVINCI_MCASP_XMASK_REG);
+
+	// format
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_XFMT_REG, regs->fmt);
+	REG_DUMP(mcasp, DAVINCI_MCASP_XFMT_REG);
+
+	// frame sync
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_AFSXCTL_REG, regs->afsctl);
+	REG_DUMP(mcasp, DAVINCI_MCASP_AFSXCTL_REG);
+
+	// bit clock
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_ACLKXCTL_REG, regs->aclkctl);
+	REG_DUMP(mcasp, DAVINCI_MCASP_ACLKXCTL_REG);
+
+	// high clock
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG, regs->ahclkctl);
+	REG_DUMP(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG);
+
+	// XUNDRN interrupt eanble
+	mcasp_set_bits(mcasp, DAVINCI_MCASP_XINTCTL_REG, XUNDRN | XSYNCERR | XCKFAIL | XDMAERR);
+	REG_DUMP(mcasp,DAVINCI_MCASP_XINTCTL_REG);
+
+	// set clock check
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_XCLKCHK_REG, regs->clkchk);
+	REG_DUMP(mcasp, DAVINCI_MCASP_XCLKCHK_REG);
+
+	// set TDM
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_XTDM_REG, regs->tdm);
+	REG_DUMP(mcasp, DAVINCI_MCASP_XTDM_REG);
+
+
+	mcasp_clr_bits(mcasp, MCASP_WFIFOCTL_REG, FIFO_ENABLE);
+	// NUMDMA must be equal to number of serielizer or DMAERR
+	// NUMEVT think it is not important
+	mcasp_mod_bits(mcasp, MCASP_WFIFOCTL_REG, NUMDMA(0x1) | NUMEVT(0x6), NUMDMA_MASK | NUMEVT_MASK);
+	mcasp_set_bits(mcasp, MCASP_WFIFOCTL_REG, FIFO_ENABLE);
+
+	return;
+}
+
+static void mcasp_serializer_init(struct davinci_mcasp *mcasp, const struct mcasp_regset *regs) {
+	int n;
+
+	// serializer roles, unused ones are inactive
+	for (n = 0; n < MCASP_NUM_SERIALIZERS; n++)
+		mcasp_update_reg(mcasp, DAVINCI_MCASP_SRCTL_REG(n), regs->srctl[n]);
+	REG_DUMP(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNTX));
+	REG_DUMP(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNRX));
+
+	WRITE_ONCE(mcasp->tx_ser, regs->tx_ser);
+	WRITE_ONCE(mcasp->rx_ser, regs->rx_ser);
+	if (regs->burst && !mcasp->burst)
+		mcasp_burst_drop_marks(mcasp);
+	WRITE_ONCE(mcasp->burst, regs->burst);
+	mcasp->extclk.flags = regs->ext_clk;
+}
+
+static void mcasp_pdir_init(struct davinci_mcasp *mcasp, const struct mcasp_regset *regs) {
+
+	// setup pin directions
+	// set -> output
+	// clr -> input
+	mcasp_update_reg(mcasp, DAVINCI_MCASP_PDIR_REG, regs->pdir);
+	REG_DUMP(mcasp, DAVINCI_MCASP_PDIR_REG);
+}
+
+static void mcasp_loopback_init(struct davinci_mcasp *mcasp) {
+
+	if (mcasp->loopback) {
+		dev_info(mcasp->dev, "Device loopback enabled");
+		mcasp_mod_bits(mcasp, DAVINCI_MCASP_DLBCTL_REG,
+			DLBEN | DLBORD | DLBMODE(1),
+			DLBEN | DLBORD | DLBMODE_MASK);
+	} else {
+		mcasp_clr_bits(mcasp, DAVINCI_MCASP_DLBCTL_REG, DLBEN);
+	}
+	REG_DUMP(mcasp, DAVINCI_MCASP_DLBCTL_REG);
+}
+
+static int mcasp_hw_init(struct davinci_mcasp *mcasp) {
+	const struct mcasp_regset *regs = &mcasp->profiles[mcasp->cur_profile].regs;
+
+	mcasp->revision = mcasp_get_reg(mcasp, DAVINCI_MCASP_REV_REG);
+	REG_DUMP(mcasp, DAVINCI_MCASP_REV_REG);
+
+	dev_dbg(mcasp->dev, "Starting intialization.");
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, 0x0);
+	REG_DUMP(mcasp, DAVINCI_MCASP_GBLCTL_REG);
+
+	mcasp_regcache_init(mcasp);
+
+	// power configuration
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_PWRIDLESYSCONFIGT_REG, MCASP_SMARTIDLE);
+	REG_DUMP(mcasp, DAVINCI_MCASP_PWRIDLESYSCONFIGT_REG);
+
+	mcasp_tx_init(mcasp, &regs->tx);
+	mcasp_rx_init(mcasp, &regs->rx);
+
+	mcasp_serializer_init(mcasp, regs);
+
+	// set all pins as McASP
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_PFUNC_REG, 0x00000000);
+	REG_DUMP(mcasp, DAVINCI_MCASP_PFUNC_REG);
+
+	mcasp_pdir_init(mcasp, regs);
+
+	mcasp_loopback_init(mcasp);
+
+	// clear receive status register
+	dev_dbg(mcasp->dev, "Clearing RSTAT register");
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, 0xFFFF);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RSTAT_REG);
+
+	// clear transmit status register
+	dev_dbg(mcasp->dev, "Clearing XSTAT register");
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, 0xFFFF);
+	REG_DUMP(mcasp, DAVINCI_MCASP_XSTAT_REG);
+
+	dev_dbg(mcasp->dev, "Initalization finished");
+	REG_DUMP(mcasp, DAVINCI_MCASP_GBLCTL_REG);
+	REG_DUMP(mcasp, DAVINCI_MCASP_RSTAT_REG);
+	REG_DUMP(mcasp, DAVINCI_MCASP_XSTAT_REG);
+
+	return 0;
+}
+
+static void mcasp_sw_free(struct davinci_mcasp *mcasp) {
+	int i;
+
+	if (mcasp->tx_buf.buf)
+		free_page((long unsigned int) mcasp->tx_buf.buf);
+	if (mcasp->prio_buf.buf)
+		free_page((long unsigned int) mcasp->prio_buf.buf);
+	mcasp->tx_buf.buf = mcasp->prio_buf.buf = NULL;
+
+	for (i = 0; i < MCASP_RX_RING_PAGES; i++) {
+		if (mcasp->rx_ring.pages[i])
+			put_page(mcasp->rx_ring.pages[i]);
+		mcasp->rx_ring.pages[i] = NULL;
+	}
+}
+
+static int mcasp_sw_init(struct davinci_mcasp *mcasp) {
+	unsigned long tx_page;
+	int retval, err = 0, i;
+	dev_t chrdev = 0;
+
+	tx_page = get_zeroed_page(GFP_KERNEL);
+	if (!tx_page) {
+		retval =  -ENOMEM;
+		goto err;
+	}
+
+	if(mcasp->tx_buf.buf) {
+		free_page(tx_page);
+	} else {
+		mcasp->tx_buf.buf = (u32 *) tx_page;
+	}
+
+	if (!mcasp->prio_buf.buf) {
+		mcasp->prio_buf.buf = (u32 *) get_zeroed_page(GFP_KERNEL);
+		if (!mcasp->prio_buf.buf) {
+			retval =  -ENOMEM;
+			goto err;
+		}
+	}
+
+	for (i = 0; i < MCASP_RX_RING_PAGES; i++) {
+		if (mcasp->rx_ring.pages[i])
+			continue;
+
+		mcasp->rx_ring.pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!mcasp->rx_ring.pages[i]) {
+			retval =  -ENOMEM;
+			goto err;
+		}
+	}
+
+	mutex_lock(&mcasp->tx_lock);
+	mcasp->tx_buf.head = mcasp->tx_buf.tail = 0;
+	mcasp->prio_buf.head = mcasp->prio_buf.tail = 0;
+	mutex_unlock(&mcasp->tx_lock);
+	mcasp->rx_ring.head = 0;
+	mcasp->rx_ring.seg = page_address(mcasp->rx_ring.pages[0]);
+
+	// alloc_chrdev_region — register a range of char device numbers
+	err = alloc_chrdev_region(&chrdev, 0, 1, MCASP_DEVICE_NAME);
+	if (err < 0) {
+		dev_alert(mcasp->dev, "failed to register a majon number");
+		retval = err;
+		goto err;
+	}
+
+	mcasp->majorNum = MAJOR(chrdev);
+
+	cdev_init(&mcasp->cdev, &mcasp_file_ops);
+	mcasp->cdev.owner = THIS_MODULE;
+	mcasp->cdev.ops = &mcasp_file_ops;
+
+	err = cdev_add(&mcasp->cdev, chrdev, 1);
+	if(err) {
+		dev_alert(mcasp->dev, "cdev_add failed %d", err);
+		unregister_chrdev_region(chrdev, 1);
+		retval = err;
+		goto err;
+	}
+
+	dev_info(mcasp->dev, "registred device %d", mcasp->majorNum);
+	dev_info(mcasp->dev, "mknod /dev/mcasp c %d 0", mcasp->majorNum);
+
+	return 0;
+
+err:
+	mcasp_sw_free(mcasp);
+
+	return retval;
+}
+
+static void mcasp_sw_exit(struct davinci_mcasp *mcasp) {
+
+	cdev_del(&mcasp->cdev);
+	unregister_chrdev_region(MKDEV(mcasp->majorNum, 0), 1);
+	mcasp_sw_free(mcasp);
+}
+
+/*
+ * Fill the write FIFO while the serializer is out of reset but the state
+ * machine is not, so the first frame goes out with real data and the
+ * worker does not have to race XSMRST. Caller makes sure the worker is parked.
+ */
+static void mcasp_tx_prime(struct davinci_mcasp *mcasp) {
+	u32 level = mcasp_get_reg(mcasp, MCASP_WFIFOSTS_REG);
+	u32 buf[FIFO_DEPTH];
+	u32 n = 0, room, got;
+
+	if (level >= FIFO_DEPTH)
+		return;
+	room = FIFO_DEPTH - level;
+
+	if (mcasp->burst) {
+		// the first transaction with its chip select window, the rest waits
+		n = mcasp_burst_stage(mcasp, mcasp->queue, buf, room, level);
+		if (!n)
+			return;
+		mcasp_burst_tx_words(mcasp, n);
+	} else {
+		// in block mode tx_buf only leaves framed, from the worker, and with a
+		// reserved slot it has to skip that slot, which the prime does not track
+		if (!mcasp->block.words && mcasp->prio_slot < 0) {
+			n = mcasp_tx_buf_run(mcasp, buf, room);
+			n += mcasp_tx_buf_run(mcasp, buf + n, room - n);
+
+			// a loaded pattern replaces the filler, as in the worker
+			while (n < room && (got = mcasp_pattern_run(&mcasp->pattern, buf + n, room - n)))
+				n += got;
+		}
+
+		for (; n < room; n++)
+			buf[n] = TX_FILLER;
+	}
+
+	mcasp_write_dat_rep(mcasp, DAVINCI_MCASP_XBUF_REG(mcasp->tx_ser), buf, n);
+	mcasp_sched_count(&mcasp->sched, n);
+}
+
+/*
+ * Frame zero is the first word primed into the FIFO. A block cut off by the
+ * restart is dropped, queued blocks keep their frames and may go out late.
+ */
+static void mcasp_sched_restart(struct davinci_mcasp *mcasp) {
+	struct mcasp_sched *s = &mcasp->sched;
+	const struct mcasp_profile *p = &mcasp->profiles[mcasp->cur_profile].cfg;
+	unsigned long rate = IS_ERR_OR_NULL(mcasp->clk) ? 0 : clk_get_rate(mcasp->clk);
+
+	// frame timing of a remote bit clock is unknown, only frame releases work
+	if (p->flags & MCASP_PROFILE_TX_EXT_CLK)
+		rate = 0;
+
+	kfree(s->cur);
+	s->cur = NULL;
+	s->measuring = false;
+	s->tx_words = s->tx_frame = 0;
+	s->frame_pos = 0;
+
+	s->words_per_frame = max(hweight32(p->slot_mask), 1U);
+	s->slot_ns = rate ? div64_u64((u64)p->slot_size * (p->clk_div + 1) *
+		(p->hclk_div + 1) * NSEC_PER_SEC, rate) : 0;
+	s->frame_ns = s->slot_ns * p->slots;
+	s->start_ns = ktime_get_ns();
+}
+
+static int mcasp_start_tx(struct davinci_mcasp *mcasp) {
+	u32 stat;
+	int retval;
+
+	retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, XHCLKRST);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, XCLKRST);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, XSRCLR);
+	if (retval)
+		return retval;
+
+	mcasp_sched_restart(mcasp);
+	mcasp_burst_close(mcasp);
+	mcasp->extclk.tx.seen = jiffies;
+	mcasp->extclk.tx.lost = false;
+	mcasp->extclk.tx_consumed = 0;
+	mcasp_tx_prime(mcasp);
+
+	// XDATA clears once the FIFO has serviced XBUF, not fatal if it does not
+	readl_relaxed_poll_timeout_atomic(mcasp->base + DAVINCI_MCASP_XSTAT_REG,
+		stat, !(stat & XRDATA), 0, GBLCTL_TIMEOUT_US);
+
+	retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, XSMRST);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, XFSRST);
+
+	return retval;
+}
+
+static void mcasp_decim_reset(struct mcasp_decim *d) {
+	memset(d->integ, 0, sizeof(d->integ));
+	memset(d->comb, 0, sizeof(d->comb));
+	memset(d->hist, 0, sizeof(d->hist));
+	d->hist_pos = 0;
+	d->phase = d->cfg.ratio;
+}
+
+static int mcasp_start_rx(struct davinci_mcasp *mcasp) {
+	int retval;
+
+	// worker is parked, the frame phase starts over with the receiver
+	mcasp->frame.aligned = false;
+	mcasp->extclk.rx.seen = jiffies;
+	mcasp->extclk.rx.lost = false;
+	mcasp->extclk.rx_drained = mcasp->extclk.rx_arrived = 0;
+	mcasp_decim_reset(&mcasp->decim);
+
+	retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, RHCLKRST);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, RCLKRST);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, RSRCLR);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, RSMRST);
+	if (!retval)
+		retval = mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, RFSRST);
+
+	REG_DUMP(mcasp, DAVINCI_MCASP_RSTAT_REG);
+
+	return retval;
+}
+
+static void mcasp_worker_park(struct davinci_mcasp *mcasp) {
+
+	if (!mcasp->running)
+		return;
+
+	kthread_park(mcasp->worker);
+	mcasp->running = false;
+}
+
+static int mcasp_worker_unpark(struct davinci_mcasp *mcasp) {
+
+	if (mcasp->running)
+		return 0;
+
+	if (!mcasp->worker) {
+		mcasp->worker = kthread_run(&mcasp_worker, mcasp, "mcasp_worker");
+		if (IS_ERR(mcasp->worker)) {
+			int retval = PTR_ERR(mcasp->worker);
+
+			mcasp->worker = NULL;
+			return retval;
+		}
+	} else {
+		kthread_unpark(mcasp->worker);
+	}
+
+	mcasp->running = true;
+	return 0;
+}
+
+/* latency from t0 to the first word on RX, completed by the worker */
+static void mcasp_mark_started(struct davinci_mcasp *mcasp, ktime_t t0) {
+
+	mcasp->stats.starts++;
+	mcasp->stats.start_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+	mcasp->start_time = t0;
+	mcasp->first_frame_pending = true;
+}
+
+static int mcasp_start(struct davinci_mcasp *mcasp) {
+	ktime_t t0 = ktime_get();
+	int retval;
+
+	dev_dbg(mcasp->dev, "Starting McASP");
+
+	// RX ring is left alone, open readers keep their positions across restarts,
+	// a write() in progress keeps its own head and would publish it over the reset
+	mutex_lock(&mcasp->tx_lock);
+	mcasp->tx_buf.head = mcasp->tx_buf.tail = 0;
+	mcasp->prio_buf.head = mcasp->prio_buf.tail = 0;
+	memset(mcasp->tx_marks, 0, sizeof(mcasp->tx_marks));
+	mcasp->tx_lat[MCASP_LANE_BULK].pending = false;
+	mcasp->tx_lat[MCASP_LANE_PRIO].pending = false;
+	mutex_unlock(&mcasp->tx_lock);
+	mcasp->pattern.pos = 0;
+
+	// worker is parked here, the prime below owns the TX ring
+	retval = mcasp_start_rx(mcasp);
+	if (!retval)
+		retval = mcasp_start_tx(mcasp);
+
+	mcasp_mark_started(mcasp, t0);
+
+	if (retval)
+		return retval;
+
+	return mcasp_worker_unpark(mcasp);
+}
+
+static int mcasp_stop_tx(struct davinci_mcasp *mcasp) {
+
+	mcasp_clear_ctl_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG);
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, 0xFFFF);
+
+	// words in flight are lost with the transmitter
+	mcasp_burst_close(mcasp);
+
+	return 0;
+}
+
+static int mcasp_stop_rx(struct davinci_mcasp *mcasp) {
+
+	mcasp_clear_ctl_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG);
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, 0xFFFF);
+
+	return 0;
+}
+
+static int mcasp_stop(struct davinci_mcasp *mcasp) {
+
+	dev_dbg(mcasp->dev, "Stopping McASP");
+	mcasp_worker_park(mcasp);
+	mcasp_stop_tx(mcasp);
+	mcasp_stop_rx(mcasp);
+
+	return 0;
+}
+
+/*
+ * DLBCTL may only change while the serializers are in reset,
+ * so the link is restarted around it.
+ */
+static int mcasp_set_loopback(struct davinci_mcasp *mcasp, bool enable) {
+
+	if (mcasp->loopback == enable)
+		return 0;
+
+	mcasp_stop(mcasp);
+	mcasp->loopback = enable;
+	mcasp_loopback_init(mcasp);
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, 0xFFFF);
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, 0xFFFF);
+
+	return mcasp_start(mcasp);
+}
+
+static int mcasp_selftest_run(struct davinci_mcasp *mcasp, struct mcasp_selftest *res) {
+	struct mcasp_selftest_state *st = &mcasp->selftest;
+	bool old_loopback = mcasp->loopback;
+	u32 underruns, overruns;
+	unsigned long timeout;
+	ktime_t start;
+	u64 elapsed;
+	int retval = 0;
+
+	if (!res->duration_ms)
+		res->duration_ms = SELFTEST_DEFAULT_MS;
+	if (res->duration_ms > SELFTEST_MAX_MS)
+		return -EINVAL;
+
+	if (!(res->flags & MCASP_SELFTEST_EXTERNAL)) {
+		retval = mcasp_set_loopback(mcasp, true);
+		if (retval)
+			return retval;
+	}
+
+	st->tx_lfsr = PRBS_SEED;
+	st->locked = false;
+	st->bad_run = 0;
+	st->tx_words = st->rx_words = 0;
+	st->bit_errors = st->word_errors = 0;
+	st->resyncs = 0;
+	st->stop = false;
+	reinit_completion(&st->done);
+
+	underruns = mcasp->stats.tx_underruns;
+	overruns = mcasp->stats.rx_overruns;
+	start = ktime_get();
+	smp_wmb();
+	WRITE_ONCE(st->active, true);
+
+	if (msleep_interruptible(res->duration_ms))
+		retval = -EINTR;
+
+	WRITE_ONCE(st->stop, true);
+	timeout = wait_for_completion_timeout(&st->done, msecs_to_jiffies(100));
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (!timeout) {
+		dev_err(mcasp->dev, "Self-test worker did not stop");
+		WRITE_ONCE(st->active, false);
+		retval = -ETIMEDOUT;
+	}
+
+	res->elapsed_ns = elapsed;
+	res->tx_words = st->tx_words;
+	res->rx_words = st->rx_words;
+	res->words_per_sec = elapsed ? div64_u64(st->rx_words * NSEC_PER_SEC, elapsed) : 0;
+	res->bit_errors = st->bit_errors;
+	res->word_errors = st->word_errors;
+	res->resyncs = st->resyncs;
+	res->locked = st->locked;
+	res->underruns = mcasp->stats.tx_underruns - underruns;
+	res->overruns = mcasp->stats.rx_overruns - overruns;
+
+	dev_info(mcasp->dev, "Self-test: %llu words/s, %llu bit errors, %llu word errors",
+		res->words_per_sec, res->bit_errors, res->word_errors);
+
+	if (!(res->flags & MCASP_SELFTEST_EXTERNAL))
+		mcasp_set_loopback(mcasp, old_loopback);
+
+	return retval;
+}
+
+/* allocated on first mmap, lives until the device goes away */
+static struct mcasp_queue *mcasp_queue_get(struct davinci_mcasp *mcasp) {
+	struct mcasp_queue *q = mcasp->queue;
+
+	BUILD_BUG_ON(sizeof(struct mcasp_sqe) != 32);
+	BUILD_BUG_ON(sizeof(struct mcasp_cqe) != 32);
+
+	if (q)
+		return q;
+
+	q = kzalloc(sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return NULL;
+
+	q->mem = vmalloc_user(MCASP_QUEUE_MAP_SIZE);
+	if (!q->mem) {
+		kfree(q);
+		return NULL;
+	}
+
+	q->hdr = q->mem;
+	q->sq = q->mem + MCASP_QUEUE_SQ_OFF;
+	q->cq = q->mem + MCASP_QUEUE_CQ_OFF;
+	q->data = q->mem + MCASP_QUEUE_DATA_OFF;
+
+	q->hdr->entries = MCASP_QUEUE_ENTRIES;
+	q->hdr->data_size = MCASP_QUEUE_DATA_SIZE;
+	q->hdr->sq_off = MCASP_QUEUE_SQ_OFF;
+	q->hdr->cq_off = MCASP_QUEUE_CQ_OFF;
+	q->hdr->data_off = MCASP_QUEUE_DATA_OFF;
+	q->hdr->map_size = MCASP_QUEUE_MAP_SIZE;
+
+	init_waitqueue_head(&q->wait);
+
+	// publish to the worker only when fully set up
+	smp_store_release(&mcasp->queue, q);
+
+	return q;
+}
+
+static void mcasp_queue_free(struct davinci_mcasp *mcasp) {
+
+	if (!mcasp->queue)
+		return;
+
+	vfree(mcasp->queue->mem);
+	kfree(mcasp->queue);
+	mcasp->queue = NULL;
+}
+
+static inline u32 mcasp_queue_ready(struct mcasp_queue *q) {
+	return READ_ONCE(q->cq_tail) - READ_ONCE(q->hdr->cq_head);
+}
+
+static long mcasp_queue_wait(struct mcasp_queue *q, u32 count) {
+	int retval;
+
+	if (count > MCASP_QUEUE_ENTRIES)
+		return -EINVAL;
+
+	retval = wait_event_interruptible(q->wait, mcasp_queue_ready(q) >= count);
+	if (retval)
+		return retval;
+
+	return mcasp_queue_ready(q);
+}
+
+/* framing state is reset, the counters keep running */
+static int mcasp_set_block(struct davinci_mcasp *mcasp, const struct mcasp_block *cfg) {
+	struct mcasp_block_state *b = &mcasp->block;
+	bool running = mcasp->running;
+
+	if (cfg->words > MCASP_BLOCK_MAX_WORDS)
+		return -EINVAL;
+	if (cfg->words && (READ_ONCE(mcasp->sched.queued) || mcasp->frame.enabled ||
+	    mcasp->frame.latest_users || mcasp->decim.cfg.ratio || mcasp->prio_slot >= 0))
+		return -EBUSY;
+
+	mcasp_worker_park(mcasp);
+
+	b->words = cfg->words;
+	b->tx_pos = b->rx_pos = 0;
+	b->rx_synced = false;
+
+	if (running)
+		return mcasp_worker_unpark(mcasp);
+
+	return 0;
+}
+
+static int mcasp_set_frame_align(struct davinci_mcasp *mcasp, bool enable) {
+	struct mcasp_frame_state *f = &mcasp->frame;
+	bool running = mcasp->running;
+
+	if (enable && (mcasp->block.words || mcasp->burst || mcasp->decim.cfg.ratio))
+		return -EBUSY;
+
+	mcasp_worker_park(mcasp);
+
+	f->enabled = enable;
+	f->aligned = false;
+
+	if (running)
+		return mcasp_worker_unpark(mcasp);
+
+	return 0;
+}
+
+static int mcasp_set_rx_latest(struct davinci_mcasp *mcasp, struct mcasp_file *mf, bool enable) {
+	struct mcasp_frame_state *f = &mcasp->frame;
+	bool running = mcasp->running;
+
+	if (enable == mf->latest)
+		return 0;
+	if (enable && (mcasp->block.words || mcasp->burst || mcasp->decim.cfg.ratio))
+		return -EBUSY;
+
+	mcasp_worker_park(mcasp);
+
+	if (enable && !f->latest_users++) {
+		memset(&f->latest, 0, sizeof(f->latest));
+		if (!f->enabled)
+			f->aligned = false;
+	} else if (!enable) {
+		f->latest_users--;
+	}
+	mf->latest = enable;
+
+	if (running)
+		return mcasp_worker_unpark(mcasp);
+
+	return 0;
+}
+
+/* filter state starts over, the stats keep counting */
+/* every received bit is a modulator bit: one slot, all 32 bits valid */
+static bool mcasp_decim_profile_ok(const struct mcasp_profile *p) {
+	return hweight32(p->slot_mask) == 1 && p->slot_size == 32 && p->word_mask == 0xFFFFFFFF;
+}
+
+static int mcasp_set_decim(struct davinci_mcasp *mcasp, const struct mcasp_decim_cfg *cfg) {
+	struct mcasp_decim *d = &mcasp->decim;
+	bool running = mcasp->running;
+
+	if (cfg->ratio) {
+		if (cfg->ratio < 2 || !cfg->order || cfg->order > MCASP_DECIM_MAX_ORDER)
+			return -EINVAL;
+		// worst case output is ratio^order and must fit a signed word
+		if (cfg->order * ilog2(cfg->ratio - 1) + cfg->order >= 31)
+			return -EINVAL;
+		if (cfg->shift > 31 || cfg->fir_taps > MCASP_DECIM_MAX_TAPS || cfg->fir_shift > 47)
+			return -EINVAL;
+		if (!mcasp_decim_profile_ok(&mcasp->profiles[mcasp->cur_profile].cfg))
+			return -EINVAL;
+		if (mcasp->block.words || mcasp->frame.enabled || mcasp->frame.latest_users)
+			return -EBUSY;
+	}
+
+	mcasp_worker_park(mcasp);
+
+	d->cfg = *cfg;
+	mcasp_decim_reset(d);
+
+	if (running)
+		return mcasp_worker_unpark(mcasp);
+
+	return 0;
+}
+
+/* the slot would cut into transactions, scheduled and CRC blocks, so it excludes them */
+static int mcasp_set_prio_slot(struct davinci_mcasp *mcasp, int slot) {
+	const struct mcasp_profile *p = &mcasp->profiles[mcasp->cur_profile].cfg;
+	struct mcasp_queue *q = mcasp->queue;
+	bool running = mcasp->running;
+
+	if (slot < -1 || slot >= (int)hweight32(p->slot_mask))
+		return -EINVAL;
+	if (slot >= 0 && (mcasp->burst || mcasp->block.words || READ_ONCE(mcasp->sched.queued)))
+		return -EBUSY;
+
+	mcasp_worker_park(mcasp);
+
+	// whatever is already on its way out finishes unsplit
+	if (slot >= 0 && (mcasp->sched.cur || (q && q->busy))) {
+		if (running)
+			mcasp_worker_unpark(mcasp);
+		return -EBUSY;
+	}
+
+	mcasp->prio_slot = slot;
+
+	if (running)
+		return mcasp_worker_unpark(mcasp);
+
+	return 0;
+}
+
+/* no locking, the worker picks the buffer up with xchg at the next wrap */
+static int mcasp_pattern_set(struct davinci_mcasp *mcasp, const struct mcasp_pattern *req) {
+	struct mcasp_pattern_buf *buf;
+
+	if (req->words > MCASP_PATTERN_MAX_WORDS || req->reserved)
+		return -EINVAL;
+
+	buf = vmalloc(sizeof(*buf) + req->words * sizeof(u32));
+	if (!buf)
+		return -ENOMEM;
+
+	if (copy_from_user(buf->data, u64_to_user_ptr(req->buf), req->words * sizeof(u32))) {
+		vfree(buf);
+		return -EFAULT;
+	}
+	buf->words = req->words;
+
+	// a pattern still waiting for the wrap is replaced
+	vfree(xchg(&mcasp->pattern.next, buf));
+
+	return 0;
+}
+
+static int mcasp_sched_submit(struct davinci_mcasp *mcasp, const struct mcasp_sched_tx *req) {
+	struct mcasp_sched *s = &mcasp->sched;
+	struct mcasp_sched_entry *e, *pos;
+	u64 frame, target;
+
+	if (!req->words || req->words > MCASP_SCHED_MAX_WORDS ||
+	    (req->flags & ~MCASP_SCHED_FRAME))
+		return -EINVAL;
+	if (mcasp->block.words || mcasp->burst || mcasp->prio_slot >= 0)
+		return -EBUSY;
+	if (!s->frame_ns && !(req->flags & MCASP_SCHED_FRAME))
+		return -ENODEV;
+
+	if (req->flags & MCASP_SCHED_FRAME) {
+		frame = req->release;
+		target = s->start_ns + frame * s->frame_ns;
+	} else {
+		target = req->release;
+		// first frame starting at or after the release, never early
+		frame = target > s->start_ns ?
+			div64_u64(target - s->start_ns + s->frame_ns - 1, s->frame_ns) : 0;
+	}
+
+	e = kmalloc(sizeof(*e) + req->words * sizeof(u32), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+
+	if (copy_from_user(e->data, u64_to_user_ptr(req->buf), req->words * sizeof(u32))) {
+		kfree(e);
+		return -EFAULT;
+	}
+	e->frame = frame;
+	e->target_ns = target;
+	e->words = req->words;
+
+	spin_lock(&s->lock);
+	if (s->queued >= MCASP_SCHED_MAX_QUEUED) {
+		spin_unlock(&s->lock);
+		kfree(e);
+		return -EBUSY;
+	}
+
+	// same frame keeps submission order
+	list_for_each_entry(pos, &s->queue, node)
+		if (pos->frame > frame)
+			break;
+	list_add_tail(&e->node, &pos->node);
+	WRITE_ONCE(s->queued, s->queued + 1);
+	spin_unlock(&s->lock);
+
+	return 0;
+}
+
+static void mcasp_sched_get_status(struct davinci_mcasp *mcasp, struct mcasp_sched_status *st) {
+	struct mcasp_sched *s = &mcasp->sched;
+	u64 now = ktime_get_ns();
+
+	*st = s->status;
+	st->frame_ns = s->frame_ns;
+	st->frame = s->frame_ns && now > s->start_ns ? div64_u64(now - s->start_ns, s->frame_ns) : 0;
+	st->queued = READ_ONCE(s->queued);
+}
+
+static void mcasp_sched_free(struct davinci_mcasp *mcasp) {
+	struct mcasp_sched *s = &mcasp->sched;
+	struct mcasp_sched_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &s->queue, node) {
+		list_del(&e->node);
+		kfree(e);
+	}
+	s->queued = 0;
+
+	kfree(s->cur);
+	s->cur = NULL;
+}
+
+/* hand the chip select line back to burst mode */
+static void mcasp_capture_gpio_release(struct davinci_mcasp *mcasp) {
+	struct mcasp_capture_state *c = &mcasp->capture;
+
+	if (c->irq <= 0)
+		return;
+
+	free_irq(c->irq, mcasp);
+	c->irq = 0;
+	gpiod_direction_output(mcasp->cs_gpio, 0);
+}
+
+static int mcasp_capture_gpio_request(struct davinci_mcasp *mcasp, u32 trigger) {
+	struct mcasp_capture_state *c = &mcasp->capture;
+	unsigned long flags;
+	int irq, retval;
+
+	if (!mcasp->cs_gpio)
+		return -ENODEV;
+	if (mcasp->burst)
+		return -EBUSY;
+
+	if (trigger == MCASP_TRIGGER_GPIO_RISING)
+		flags = IRQF_TRIGGER_RISING;
+	else if (trigger == MCASP_TRIGGER_GPIO_FALLING)
+		flags = IRQF_TRIGGER_FALLING;
+	else
+		flags = IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING;
+
+	mcasp_capture_gpio_release(mcasp);
+
+	retval = gpiod_direction_input(mcasp->cs_gpio);
+	if (retval)
+		return retval;
+
+	irq = gpiod_to_irq(mcasp->cs_gpio);
+	if (irq < 0)
+		return irq;
+
+	retval = request_irq(irq, mcasp_trigger_irq_handler, flags, "mcasp_trigger", mcasp);
+	if (retval) {
+		gpiod_direction_output(mcasp->cs_gpio, 0);
+		return retval;
+	}
+
+	c->irq = irq;
+	return 0;
+}
+
+static int mcasp_capture_arm(struct davinci_mcasp *mcasp, const struct mcasp_capture *cfg) {
+	struct mcasp_capture_state *c = &mcasp->capture;
+	bool gpio = cfg->trigger >= MCASP_TRIGGER_GPIO_RISING;
+	int retval = 0;
+
+	if (cfg->trigger > MCASP_TRIGGER_GPIO_BOTH)
+		return -EINVAL;
+
+	if (cfg->trigger != MCASP_TRIGGER_OFF &&
+	    (!cfg->post_words || (u64)cfg->pre_words + cfg->post_words > MCASP_CAPTURE_MAX_WORDS))
+		return -EINVAL;
+
+	// allocated once, the worker may still be writing the old window
+	if (!c->buf) {
+		c->buf = vmalloc(MCASP_CAPTURE_MAX_WORDS * sizeof(u32));
+		if (!c->buf)
+			return -ENOMEM;
+	}
+
+	if (gpio)
+		retval = mcasp_capture_gpio_request(mcasp, cfg->trigger);
+	else
+		mcasp_capture_gpio_release(mcasp);
+	if (retval)
+		return retval;
+
+	WRITE_ONCE(c->fire, false);
+	c->trigger_ns = 0;
+	c->req = *cfg;
+	c->armed = cfg->trigger != MCASP_TRIGGER_OFF;
+	smp_store_release(&c->req_seq, c->req_seq + 1);
+
+	return 0;
+}
+
+static int mcasp_capture_trigger(struct davinci_mcasp *mcasp) {
+	struct mcasp_capture_state *c = &mcasp->capture;
+
+	if (!c->armed)
+		return -EINVAL;
+
+	if (!READ_ONCE(c->fire)) {
+		c->trigger_ns = ktime_get_ns();
+		smp_wmb();
+		WRITE_ONCE(c->fire, true);
+	}
+
+	return 0;
+}
+
+static inline bool mcasp_capture_done(struct mcasp_capture_state *c, u32 seq) {
+	return READ_ONCE(c->seq) == seq && smp_load_acquire(&c->state) == MCASP_CAPTURE_DONE;
+}
+
+/* the window stays frozen until the next arm, which needs mcasp->lock */
+static int mcasp_capture_wait(struct davinci_mcasp *mcasp, struct mcasp_capture_result *res) {
+	struct mcasp_capture_state *c = &mcasp->capture;
+	u32 __user *ubuf = u64_to_user_ptr(res->buf);
+	u32 seq, words, start, chunk;
+	int retval;
+
+	mutex_lock(&mcasp->lock);
+	seq = c->req_seq;
+	retval = c->armed ? 0 : -EINVAL;
+	mutex_unlock(&mcasp->lock);
+	if (retval)
+		return retval;
+
+	retval = wait_event_interruptible(c->wait, mcasp_capture_done(c, seq));
+	if (retval)
+		return retval;
+
+	mutex_lock(&mcasp->lock);
+	if (c->req_seq != seq) {
+		// re-armed while we slept
+		retval = -EAGAIN;
+		goto out;
+	}
+
+	words = c->pre_avail + c->cfg.post_words;
+	start = (c->idx + c->size - words) % c->size;
+	res->pre_words = c->pre_avail;
+	res->trigger_word = c->trigger_word;
+	res->trigger_ns = c->trigger_ns;
+
+	// skip the head of the window when it does not fit
+	if (words > res->size) {
+		start = (start + words - res->size) % c->size;
+		res->pre_words -= min(res->pre_words, words - res->size);
+		words = res->size;
+	}
+	res->words = words;
+
+	chunk = min(words, c->size - start);
+	if (copy_to_user(ubuf, &c->buf[start], chunk * sizeof(u32)) ||
+	    copy_to_user(ubuf + chunk, c->buf, (words - chunk) * sizeof(u32)))
+		retval = -EFAULT;
+
+out:
+	mutex_unlock(&mcasp->lock);
+	return retval;
+}
+
+static void mcasp_capture_free(struct davinci_mcasp *mcasp) {
+
+	mcasp_capture_gpio_release(mcasp);
+	vfree(mcasp->capture.buf);
+	mcasp->capture.buf = NULL;
+}
+
+static const struct mcasp_dir_regs mcasp_tx_offsets = {
+	.mask = DAVINCI_MCASP_XMASK_REG,
+	.fmt = DAVINCI_MCASP_XFMT_REG,
+	.afsctl = DAVINCI_MCASP_AFSXCTL_REG,
+	.aclkctl = DAVINCI_MCASP_ACLKXCTL_REG,
+	.ahclkctl = DAVINCI_MCASP_AHCLKXCTL_REG,
+	.tdm = DAVINCI_MCASP_XTDM_REG,
+};
+
+static const struct mcasp_dir_regs mcasp_rx_offsets = {
+	.mask = DAVINCI_MCASP_RMASK_REG,
+	.fmt = DAVINCI_MCASP_RFMT_REG,
+	.afsctl = DAVINCI_MCASP_AFSRCTL_REG,
+	.aclkctl = DAVINCI_MCASP_ACLKRCTL_REG,
+	.ahclkctl = DAVINCI_MCASP_AHCLKRCTL_REG,
+	.tdm = DAVINCI_MCASP_RTDM_REG,
+};
 
-	// local_irq_restore(flags);
-	return IRQ_RETVAL(handled_mask);
+/* compares against the register cache, no bus access */
+static bool mcasp_dir_regs_differ(struct davinci_mcasp *mcasp,
+	const struct mcasp_dir_regs *offsets, const struct mcasp_dir_regs *regs) {
+
+	return mcasp_get_reg(mcasp, offsets->mask) != regs->mask ||
+		mcasp_get_reg(mcasp, offsets->fmt) != regs->fmt ||
+		mcasp_get_reg(mcasp, offsets->afsctl) != regs->afsctl ||
+		mcasp_get_reg(mcasp, offsets->aclkctl) != regs->aclkctl ||
+		mcasp_get_reg(mcasp, offsets->ahclkctl) != regs->ahclkctl ||
+		mcasp_get_reg(mcasp, offsets->tdm) != regs->tdm;
 }
 
-static irqreturn_t mcasp_rx_irq_handler(int irq, void *data)
-{
-	struct davinci_mcasp *mcasp = (struct davinci_mcasp *)data;
-	u32 handled_mask = 0;
-	u32 stat;
+/*
+ * Clock check window. The counter measures AHCLK, which is always ours,
+ * even with a remote bit clock, so the window is left wide open. A remote
+ * bit clock is watched by the worker instead, see mcasp_extclk_check().
+ */
+#define MCASP_CLKCHK		(CLKCHK_PS(3) | CLKCHK_MIN(0) | CLKCHK_MAX(0xFF))
 
-	stat = mcasp_get_reg(mcasp, DAVINCI_MCASP_RSTAT_REG);
+static int mcasp_profile_compile(const struct mcasp_profile *p, struct mcasp_regset *regs) {
+	bool burst = p->flags & MCASP_PROFILE_BURST;
+	bool rx_ext = p->flags & MCASP_PROFILE_RX_EXT_CLK;
+	bool tx_ext = p->flags & MCASP_PROFILE_TX_EXT_CLK;
+	bool async = rx_ext || (p->flags & MCASP_PROFILE_ASYNC);
+	u32 slots, slot_mask, fs_width;
+	u32 ssz;
 
-	if (unlikely(stat & ROVRN)) {
-		dev_err_ratelimited(mcasp->dev, "ROVRN");
-		handled_mask |= ROVRN;
-	}
+	if (p->flags & ~MCASP_PROFILE_FLAGS)
+		return -EINVAL;
+	// burst frames are paced by our own frame sync and chip select
+	if (burst && (rx_ext || tx_ext))
+		return -EINVAL;
 
-	if (unlikely(stat & XRDMAERR)) {
-		dev_err_ratelimited(mcasp->dev, "RDMAERR");
-		handled_mask |= XRDMAERR;
+	if (burst) {
+		// XMOD 0 is burst mode, one slot with a word wide frame sync
+		slots = 0;
+		slot_mask = 0x1;
+		fs_width = 1;
+	} else {
+		if (p->slots < 2 || p->slots > 32)
+			return -EINVAL;
+		if (!p->slot_mask || (p->slots < 32 && (p->slot_mask >> p->slots)))
+			return -EINVAL;
+
+		slots = p->slots;
+		slot_mask = p->slot_mask;
+		fs_width = p->fs_width;
 	}
 
-	if (unlikely(stat & XRCKFAIL)) {
-		dev_err_ratelimited(mcasp->dev, "RCKFAIL");
-		handled_mask |= XRCKFAIL;
-	}
+	if (p->slot_size < 8 || p->slot_size > 32 || (p->slot_size % 4))
+		return -EINVAL;
+	if (!p->word_mask || p->data_delay > 2 || (!burst && p->fs_width > 1))
+		return -EINVAL;
+	if (p->clk_div > CLKXDIV_MASK || p->hclk_div > HCLKXDIV_MASK)
+		return -EINVAL;
+	if (p->tx_serializer >= MCASP_NUM_SERIALIZERS || p->rx_serializer >= MCASP_NUM_SERIALIZERS ||
+		p->tx_serializer == p->rx_serializer)
+		return -EINVAL;
 
-	if (unlikely(stat & XRSYNCERR)) {
-		dev_err_ratelimited(mcasp->dev, "RSYNCERR");
-		handled_mask |= XRSYNCERR;
-	}
+	// slot size field is (bits / 2) - 1, 16 bits -> 0x7
+	ssz = p->slot_size / 2 - 1;
+
+	memset(regs, 0, sizeof(*regs));
+
+	// MSB first, no bus select. Clocks are internal unless the remote side
+	// drives them, without ASYNC TX provides the RX clock
+	regs->tx.mask = p->word_mask;
+	regs->tx.fmt = XRVRS | XROT(0) | XSSZ(ssz) | XPAD(0) | XDATDLY(p->data_delay);
+	regs->tx.afsctl = FSXP | (tx_ext ? 0 : FSXM) | XMOD(slots) | (fs_width ? FXWID : 0);
+	regs->tx.aclkctl = (tx_ext ? 0 : CLKXM) | (async ? ASYNC : 0) | CLKXP | CLKXDIV(p->clk_div);
+	regs->tx.ahclkctl = HCLKXM | HCLKXP | HCLKXDIV(p->hclk_div);
+	regs->tx.tdm = slot_mask;
+	regs->tx.clkchk = MCASP_CLKCHK;
+
+	regs->rx.mask = p->word_mask;
+	regs->rx.fmt = RRVRS | RROT(0) | RSSZ(ssz) | RPAD(0) | RDATDLY(p->data_delay);
+	regs->rx.afsctl = FSRP | (rx_ext ? 0 : FSRM) | RMOD(slots) | (fs_width ? FRWID : 0);
+	regs->rx.aclkctl = (rx_ext ? 0 : CLKRM) | CLKRP | CLKRDIV(p->clk_div);
+	regs->rx.ahclkctl = HCLKRM | HCLKRP | HCLKRDIV(p->hclk_div);
+	regs->rx.tdm = slot_mask;
+	regs->rx.clkchk = MCASP_CLKCHK;
+
+	regs->tx_ser = p->tx_serializer;
+	regs->rx_ser = p->rx_serializer;
+	regs->burst = burst;
+	regs->ext_clk = p->flags & (MCASP_PROFILE_RX_EXT_CLK | MCASP_PROFILE_TX_EXT_CLK);
+	regs->srctl[regs->tx_ser] = SRMOD_TX | DISMOD_LOW;
+	regs->srctl[regs->rx_ser] = SRMOD_RX | DISMOD_LOW;
+
+	// AHCLKX stays an output, it can serve as master clock for the remote side
+	regs->pdir = PDIR_AXR(regs->tx_ser) | PDIR_AHCLKX | PDIR_AHCLKR;
+	if (!tx_ext)
+		regs->pdir |= PDIR_ACLKX | PDIR_AFSX;
+	if (!rx_ext)
+		regs->pdir |= PDIR_ACLKR | PDIR_AFSR;
 
-	if (unlikely(stat & XRERR)) {
-		dev_err_ratelimited(mcasp->dev, "RERR 0x%08X", stat);
-		mcasp_set_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, 0);
-		handled_mask |= XRERR;
-	}
+	return 0;
+}
 
-	/* Ack the handled event only */
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, handled_mask);
+static int mcasp_set_profile(struct davinci_mcasp *mcasp, const struct mcasp_profile *p) {
+	struct mcasp_regset regs;
+	int retval;
 
-	// local_irq_restore(flags);
-	return IRQ_RETVAL(handled_mask);
-}
+	if (p->index >= MCASP_MAX_PROFILES)
+		return -EINVAL;
+	if (mcasp->decim.cfg.ratio && p->index == mcasp->cur_profile && !mcasp_decim_profile_ok(p))
+		return -EBUSY;
 
-static void mcasp_rx_init(struct davinci_mcasp *mcasp) {
+	retval = mcasp_profile_compile(p, &regs);
+	if (retval)
+		return retval;
 
-	// mask bits
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RMASK_REG, MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RMASK_REG);
+	mcasp->profiles[p->index].cfg = *p;
+	mcasp->profiles[p->index].regs = regs;
+	mcasp->profiles[p->index].valid = true;
 
-	// format bits
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_RFMT_REG, RRVRS);
-	mcasp_clr_bits(mcasp, DAVINCI_MCASP_RFMT_REG, RBUSEL);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_RFMT_REG, RROT(0), RROT_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_RFMT_REG, RSSZ(0x7), RSSZ_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_RFMT_REG, RPAD(0), RPAD_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_RFMT_REG, RDATDLY(0x1), RDATDLY_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RFMT_REG);
+	return 0;
+}
 
-	// frame sync
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_AFSRCTL_REG, FSRP | FSRM);
-	mcasp_clr_bits(mcasp, DAVINCI_MCASP_AFSRCTL_REG, FRWID);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_AFSRCTL_REG, RMOD(TDM_SLOTS_NUM), RMOD_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_AFSRCTL_REG);
+static void mcasp_profiles_init(struct davinci_mcasp *mcasp) {
+	struct mcasp_profile p = {
+		.index = 0,
+		.slots = TDM_SLOTS_NUM,
+		.slot_mask = TDM_SLOTS_CFG,
+		.word_mask = MASK,
+		.slot_size = 16,
+		.data_delay = 1,
+		.fs_width = 0,
+		.clk_div = CLK_DIV,
+		.hclk_div = HCLK_DIV,
+		.tx_serializer = AXRNTX,
+		.rx_serializer = AXRNRX,
+	};
+
+	mcasp_set_profile(mcasp, &p);
+	mcasp->cur_profile = 0;
+}
 
-	// bit clock setup
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_ACLKRCTL_REG, CLKRM | CLKRP);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_ACLKRCTL_REG, CLKRDIV(CLK_DIV), CLKRDIV_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_ACLKRCTL_REG);
+/*
+ * Switch to a precomputed profile. Only registers that differ from the
+ * shadow are written and only the direction whose registers changed is
+ * taken through reset. With ASYNC clear RX runs off the TX clocks, so a
+ * TX restart drags RX along.
+ */
+static int mcasp_switch_profile(struct davinci_mcasp *mcasp, int index) {
+	const struct mcasp_regset *regs;
+	bool tx_dirty, rx_dirty, roles, running;
+	int retval = 0;
+	ktime_t t0;
 
-	// high clock
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_AHCLKRCTL_REG, HCLKRM | HCLKRP);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_AHCLKRCTL_REG, HCLKRDIV(HCLK_DIV), HCLKRDIV_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_AHCLKRCTL_REG);
+	if (index < 0 || index >= MCASP_MAX_PROFILES || !mcasp->profiles[index].valid)
+		return -EINVAL;
 
-	// ROVRN interrupt eanble
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_RINTCTL_REG, ROVRN | RSYNCERR | RCKFAIL | RDMAERR);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RINTCTL_REG);
+	regs = &mcasp->profiles[index].regs;
+
+	// chip select is a trigger input right now
+	if (regs->burst && mcasp->capture.irq > 0)
+		return -EBUSY;
+	if (regs->burst && (mcasp->frame.enabled || mcasp->frame.latest_users))
+		return -EBUSY;
+	// the reserved priority slot has to exist in the new frame
+	if (mcasp->prio_slot >= 0 && (regs->burst || mcasp->prio_slot >= hweight32(regs->tx.tdm)))
+		return -EBUSY;
+	if (mcasp->decim.cfg.ratio && !mcasp_decim_profile_ok(&mcasp->profiles[index].cfg))
+		return -EBUSY;
+
+	roles = regs->tx_ser != mcasp->tx_ser || regs->rx_ser != mcasp->rx_ser ||
+		regs->burst != mcasp->burst;
+	tx_dirty = roles || mcasp_dir_regs_differ(mcasp, &mcasp_tx_offsets, &regs->tx);
+	rx_dirty = roles || mcasp_dir_regs_differ(mcasp, &mcasp_rx_offsets, &regs->rx);
+	if (tx_dirty && !(regs->tx.aclkctl & ASYNC))
+		rx_dirty = true;
+
+	mcasp->cur_profile = index;
+	if (!tx_dirty && !rx_dirty)
+		return 0;
+
+	t0 = ktime_get();
+	running = mcasp->running;
+	mcasp_worker_park(mcasp);
+
+	if (rx_dirty)
+		mcasp_stop_rx(mcasp);
+	if (tx_dirty)
+		mcasp_stop_tx(mcasp);
+
+	if (tx_dirty)
+		mcasp_tx_init(mcasp, &regs->tx);
+	if (rx_dirty)
+		mcasp_rx_init(mcasp, &regs->rx);
+
+	mcasp_serializer_init(mcasp, regs);
+	mcasp_pdir_init(mcasp, regs);
+
+	if (rx_dirty)
+		retval = mcasp_start_rx(mcasp);
+	if (tx_dirty && !retval)
+		retval = mcasp_start_tx(mcasp);
+
+	mcasp_mark_started(mcasp, t0);
+
+	if (running)
+		mcasp_worker_unpark(mcasp);
 
-	// clock check
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RCLKCHK_REG, 0x00FF0003);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RCLKCHK_REG);
+	return retval;
+}
 
-	// set TDM
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RTDM_REG, TDM_SLOTS_CFG);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RTDM_REG);
+/* the family is global, it serves the first McASP that registers it */
+static struct davinci_mcasp *mcasp_genl_dev;
+
+static u32 mcasp_event_count(struct davinci_mcasp *mcasp, int event) {
+
+	switch (event) {
+	case MCASP_EVENT_UNDERRUN:
+		return mcasp->stats.tx_underruns;
+	case MCASP_EVENT_OVERRUN:
+		return mcasp->stats.rx_overruns;
+	case MCASP_EVENT_CLOCK_FAIL:
+		return mcasp->stats.clock_fails;
+	case MCASP_EVENT_SYNC_ERROR:
+		return mcasp->stats.sync_errors;
+	case MCASP_EVENT_RECOVERED:
+		return mcasp->stats.recoveries;
+	case MCASP_EVENT_CLOCK_DRIFT:
+		return mcasp->clkmon.stats.tx.out_of_tolerance + mcasp->clkmon.stats.rx.out_of_tolerance;
+	default:
+		return 0;
+	}
+}
 
-	mcasp_clr_bits(mcasp, MCASP_RFIFOCTL_REG, FIFO_ENABLE);
-	// must be equal to number of serielizer or DMAERR
-	mcasp_mod_bits(mcasp, MCASP_RFIFOCTL_REG, NUMDMA(0x1), NUMDMA_MASK);
-	// think it is not important
-	mcasp_mod_bits(mcasp, MCASP_RFIFOCTL_REG, NUMEVT(0x6), NUMEVT_MASK);
-	mcasp_set_bits(mcasp, MCASP_RFIFOCTL_REG, FIFO_ENABLE);
+static void mcasp_genl_event(struct davinci_mcasp *mcasp, int event) {
+	struct sk_buff *skb;
+	void *hdr;
+
+	skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!skb)
+		return;
+
+	hdr = genlmsg_put(skb, 0, 0, &mcasp_genl_family, 0, MCASP_CMD_EVENT);
+	if (!hdr ||
+	    nla_put_u32(skb, MCASP_ATTR_EVENT, event) ||
+	    nla_put_u32(skb, MCASP_ATTR_COUNT, mcasp_event_count(mcasp, event)) ||
+	    nla_put_u64_64bit(skb, MCASP_ATTR_TIMESTAMP, ktime_get_ns(), MCASP_ATTR_PAD)) {
+		nlmsg_free(skb);
+		return;
+	}
 
-	return;
+	genlmsg_end(skb, hdr);
+	genlmsg_multicast(&mcasp_genl_family, skb, 0, MCASP_GENL_GRP_EVENTS, GFP_KERNEL);
 }
 
-static void mcasp_tx_init(struct davinci_mcasp *mcasp) {
+/* events of one kind that pile up before the work runs are sent once */
+static void mcasp_event_work(struct work_struct *work) {
+	struct davinci_mcasp *mcasp = container_of(work, struct davinci_mcasp, event_work);
+	int event;
 
-	// mask
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XMASK_REG, MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_XMASK_REG);
+	for (event = MCASP_EVENT_NONE + 1; event < __MCASP_EVENT_MAX; event++)
+		if (test_and_clear_bit(event, &mcasp->events))
+			mcasp_genl_event(mcasp, event);
+}
 
-	// format
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XRVRS);
-	mcasp_clr_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XBUSEL);
-	// mcasp_set_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XBUSEL | XRVRS);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XROT(0), XROT_MAKS);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XSSZ(0x7), XSSZ_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XPAD(0), XPAD_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_XFMT_REG, XDATDLY(0x1), XDATDLY_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_XFMT_REG);
+/* the error IRQs take a direction out of reset, bring the link back */
+static void mcasp_recover_work(struct work_struct *work) {
+	struct davinci_mcasp *mcasp = container_of(to_delayed_work(work), struct davinci_mcasp, recover_work);
+	int retval;
 
-	// frame sync
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_AFSXCTL_REG, FSXP | FSXM);
-	mcasp_clr_bits(mcasp, DAVINCI_MCASP_AFSXCTL_REG, FXWID);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_AFSXCTL_REG, XMOD(TDM_SLOTS_NUM), XMOD_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_AFSXCTL_REG);
+	mutex_lock(&mcasp->lock);
+	if (mcasp->shutdown) {
+		mutex_unlock(&mcasp->lock);
+		return;
+	}
 
-	// clock internal
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_ACLKXCTL_REG, CLKXM | CLKXP);
-	// sync clock, TX provides RX clock
-	mcasp_clr_bits(mcasp, DAVINCI_MCASP_ACLKXCTL_REG, ASYNC);
-	// clock
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_ACLKXCTL_REG, CLKXDIV(CLK_DIV), CLKXDIV_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_ACLKXCTL_REG);
+	mcasp_stop(mcasp);
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, 0xFFFF);
+	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, 0xFFFF);
+	retval = mcasp_start(mcasp);
+	if (!retval)
+		mcasp->stats.recoveries++;
+	mutex_unlock(&mcasp->lock);
+
+	if (retval)
+		dev_err(mcasp->dev, "Link recovery failed %d", retval);
+	else
+		mcasp_event_raise(mcasp, MCASP_EVENT_RECOVERED);
+}
 
-	// high clock
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG, HCLKXM | HCLKXP);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG, HCLKXDIV(HCLK_DIV), HCLKXDIV_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_AHCLKXCTL_REG);
+#define MCASP_CLKMON_COUNT	192 // target CLKCHK count at the nominal rate
 
-	// XUNDRN interrupt eanble
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_XINTCTL_REG, XUNDRN | XSYNCERR | XCKFAIL | XDMAERR);
-	REG_DUMP(mcasp,DAVINCI_MCASP_XINTCTL_REG);
+/* the bit clock of this direction comes from the remote side */
+static bool mcasp_clkmon_ext(const struct mcasp_profile *p, bool rx) {
 
-	// set clock check
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XCLKCHK_REG, 0x00FF0003);
-	REG_DUMP(mcasp, DAVINCI_MCASP_XCLKCHK_REG);
+	// without ASYNC the receiver runs off the transmit clock
+	if (rx && (p->flags & (MCASP_PROFILE_RX_EXT_CLK | MCASP_PROFILE_ASYNC)))
+		return p->flags & MCASP_PROFILE_RX_EXT_CLK;
 
-	// set TDM
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XTDM_REG, TDM_SLOTS_CFG);
-	REG_DUMP(mcasp, DAVINCI_MCASP_XTDM_REG);
+	return p->flags & MCASP_PROFILE_TX_EXT_CLK;
+}
 
+/* bit clock the profile asks for, 0 if the remote side provides it unannounced */
+static u32 mcasp_clkmon_nominal(struct davinci_mcasp *mcasp, bool rx, unsigned long fclk) {
+	const struct mcasp_profile *p = &mcasp->profiles[mcasp->cur_profile].cfg;
+	const struct mcasp_clkmon_cfg *cfg = &mcasp->clkmon.cfg;
+	u32 hz = cfg->tx_nominal_hz;
 
-	mcasp_clr_bits(mcasp, MCASP_WFIFOCTL_REG, FIFO_ENABLE);
-	// must be equal to number of serielizer or DMAERR
-	mcasp_mod_bits(mcasp, MCASP_WFIFOCTL_REG, NUMDMA(0x1), NUMDMA_MASK);
-	// think it is not important
-	mcasp_mod_bits(mcasp, MCASP_WFIFOCTL_REG, NUMEVT(0x6), NUMEVT_MASK);
-	mcasp_set_bits(mcasp, MCASP_WFIFOCTL_REG, FIFO_ENABLE);
+	if (rx && (p->flags & (MCASP_PROFILE_RX_EXT_CLK | MCASP_PROFILE_ASYNC)))
+		hz = cfg->rx_nominal_hz;
 
-	return;
+	if (hz || mcasp_clkmon_ext(p, rx))
+		return hz;
+
+	return fclk / ((p->hclk_div + 1) * (p->clk_div + 1));
 }
 
-static int mcasp_hw_init(struct davinci_mcasp *mcasp) {
+/* smallest prescaler that keeps the count at the nominal AHCLK below the target */
+static u32 mcasp_clkmon_ps(unsigned long fclk, u32 nominal) {
+	u32 ps;
 
-	mcasp->revision = mcasp_get_reg(mcasp, DAVINCI_MCASP_REV_REG);
-	REG_DUMP(mcasp, DAVINCI_MCASP_REV_REG);
+	for (ps = 0; ps < 8; ps++)
+		if (div64_u64((u64)fclk * 32, (u64)nominal << ps) <= MCASP_CLKMON_COUNT)
+			break;
 
-	dev_info(mcasp->dev, "Starting intialization.");
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, 0x0);
-	REG_DUMP(mcasp, DAVINCI_MCASP_GBLCTL_REG);
+	return ps;
+}
 
-	// power configuration
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_PWRIDLESYSCONFIGT_REG, MCASP_SMARTIDLE);
-	REG_DUMP(mcasp, DAVINCI_MCASP_PWRIDLESYSCONFIGT_REG);
+/*
+ * CLKCHK counts prescaled SYSCLK cycles per 32 AHCLK cycles, the bit clock
+ * is AHCLK / (clk_div + 1) unless the remote side drives it.
+ */
+static void mcasp_clkmon_sample(struct davinci_mcasp *mcasp, u32 reg, bool rx,
+	unsigned long fclk, struct mcasp_clk_stats *st, bool *out) {
+	const struct mcasp_profile *p = &mcasp->profiles[mcasp->cur_profile].cfg;
+	u32 nominal = mcasp_clkmon_nominal(mcasp, rx, fclk);
+	u32 ahclk_nominal = fclk / (p->hclk_div + 1);
+	u32 val = mcasp_get_reg(mcasp, reg);
+	u32 ps = val & CLKCHK_PS(0xF);
+	u32 frame_bits = p->slot_size * ((p->flags & MCASP_PROFILE_BURST) ? 1 : p->slots);
+	u32 tol = mcasp->clkmon.cfg.tolerance_ppm;
+	s64 drift, ahclk_want;
+	bool now;
+
+	st->count = CLKCHK_CNT(val);
+	st->nominal_hz = nominal;
+	st->ahclk_hz = 0;
+	st->bclk_hz = 0;
+	st->frame_mhz = 0;
+	if (st->count && st->count != 0xFF)
+		st->ahclk_hz = div64_u64((u64)fclk * 32, (u64)st->count << ps);
+
+	// window stays as compiled, a new prescaler counts from the next measurement
+	if (ahclk_nominal && mcasp_clkmon_ps(fclk, ahclk_nominal) != ps)
+		mcasp_set_reg(mcasp, reg, (val & (CLKCHK_MIN(0xFF) | CLKCHK_MAX(0xFF))) |
+			CLKCHK_PS(mcasp_clkmon_ps(fclk, ahclk_nominal)));
+
+	// a remote bit clock is watched by mcasp_extclk_check() instead
+	if (mcasp_clkmon_ext(p, rx))
+		return;
+
+	if (st->ahclk_hz) {
+		st->bclk_hz = st->ahclk_hz / (p->clk_div + 1);
+		st->frame_mhz = div_u64((u64)st->bclk_hz * 1000, frame_bits);
+		if (!st->bclk_min_hz || st->bclk_hz < st->bclk_min_hz)
+			st->bclk_min_hz = st->bclk_hz;
+		st->bclk_max_hz = max(st->bclk_max_hz, st->bclk_hz);
+	}
 
-	mcasp_tx_init(mcasp);
-	mcasp_rx_init(mcasp);
+	if (!nominal)
+		return;
+
+	// compare at AHCLK, the divided bit clock would add its own truncation
+	ahclk_want = (s64)nominal * (p->clk_div + 1);
+	drift = div64_s64(((s64)st->ahclk_hz - ahclk_want) * 1000000, ahclk_want);
+	st->drift_ppm = clamp_t(s64, drift, S32_MIN, S32_MAX);
+	if (!tol)
+		return;
+
+	now = !st->ahclk_hz || abs(drift) > tol;
+	if (now)
+		st->out_of_tolerance++;
+	if (now && !*out)
+		mcasp_event_raise(mcasp, MCASP_EVENT_CLOCK_DRIFT);
+	*out = now;
+}
 
-	// setup TX serializer
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNTX), SRMOD_TX, SRMOD_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNTX), DISMOD_LOW, DISMOD_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNTX));
+static void mcasp_clkmon_work(struct work_struct *work) {
+	struct davinci_mcasp *mcasp = container_of(to_delayed_work(work), struct davinci_mcasp, clkmon.work);
+	struct mcasp_clkmon *m = &mcasp->clkmon;
+	unsigned long fclk = IS_ERR_OR_NULL(mcasp->clk) ? 0 : clk_get_rate(mcasp->clk);
+	u32 interval;
+
+	mutex_lock(&mcasp->lock);
+	interval = m->cfg.interval_ms;
+	if (mcasp->shutdown || !interval) {
+		mutex_unlock(&mcasp->lock);
+		return;
+	}
 
-	// setup RX serializer
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNRX), SRMOD_RX, SRMOD_MASK);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNRX), DISMOD_LOW, DISMOD_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_SRCTL_REG(AXRNRX));
+	// the counts are stale while the link is down
+	if (mcasp->running && fclk) {
+		mcasp_clkmon_sample(mcasp, DAVINCI_MCASP_XCLKCHK_REG, false, fclk, &m->stats.tx, &m->tx_out);
+		mcasp_clkmon_sample(mcasp, DAVINCI_MCASP_RCLKCHK_REG, true, fclk, &m->stats.rx, &m->rx_out);
+		m->stats.samples++;
+	}
+	mutex_unlock(&mcasp->lock);
 
-	// set all pins as McASP
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_PFUNC_REG, 0x00000000);
-	REG_DUMP(mcasp, DAVINCI_MCASP_PFUNC_REG);
+	schedule_delayed_work(&m->work, msecs_to_jiffies(interval));
+}
 
-	// setup pin directions
-	// set -> output
-	// clr -> input
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_AXR(AXRNTX));
-	mcasp_clr_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_AXR(AXRNRX));
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_ACLKX);
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_AHCLKX);
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_AFSX);
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_ACLKR);
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_AHCLKR);
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_PDIR_REG, PDIR_AFSR);
-	REG_DUMP(mcasp, DAVINCI_MCASP_PDIR_REG);
+/* new settings start a fresh set of statistics */
+static int mcasp_clkmon_set(struct davinci_mcasp *mcasp, const struct mcasp_clkmon_cfg *cfg) {
+	struct mcasp_clkmon *m = &mcasp->clkmon;
 
-#ifdef MCASP_DEBUG
-	dev_info(mcasp->dev, "Device loopback enabled");
-	// setup loopback
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_DLBCTL_REG, DLBEN);
-	mcasp_set_bits(mcasp, DAVINCI_MCASP_DLBCTL_REG, DLBORD);
-	mcasp_mod_bits(mcasp, DAVINCI_MCASP_DLBCTL_REG, DLBMODE(1), DLBMODE_MASK);
-	REG_DUMP(mcasp, DAVINCI_MCASP_DLBCTL_REG);
-#endif
+	if (cfg->interval_ms && (cfg->interval_ms < 10 || cfg->interval_ms > 60000))
+		return -EINVAL;
 
-	// clear receive status register
-	dev_info(mcasp->dev, "Clearing RSTAT register");
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, 0xFFFF);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RSTAT_REG);
+	mutex_lock(&mcasp->lock);
+	m->cfg = *cfg;
+	memset(&m->stats, 0, sizeof(m->stats));
+	m->tx_out = m->rx_out = false;
+	mutex_unlock(&mcasp->lock);
 
-	// clear transmit status register
-	dev_info(mcasp->dev, "Clearing XSTAT register");
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, 0xFFFF);
-	REG_DUMP(mcasp, DAVINCI_MCASP_XSTAT_REG);
+	// the work takes mcasp->lock, never wait for it while holding that
+	if (cfg->interval_ms)
+		mod_delayed_work(system_wq, &m->work, 0);
+	else
+		cancel_delayed_work_sync(&m->work);
 
-	dev_info(mcasp->dev, "Initalization finished");
-	REG_DUMP(mcasp, DAVINCI_MCASP_GBLCTL_REG);
-	REG_DUMP(mcasp, DAVINCI_MCASP_RSTAT_REG);
-	REG_DUMP(mcasp, DAVINCI_MCASP_XSTAT_REG);
+	return 0;
+}
+
+static int mcasp_genl_fill(struct sk_buff *skb, struct davinci_mcasp *mcasp) {
+
+	if (nla_put_u8(skb, MCASP_ATTR_LOOPBACK, mcasp->loopback) ||
+	    nla_put_u32(skb, MCASP_ATTR_PROFILE, mcasp->cur_profile) ||
+	    nla_put_u8(skb, MCASP_ATTR_STREAM, mcasp->stream.enabled) ||
+	    nla_put_u32(skb, MCASP_ATTR_BATCH, mcasp->stream.batch) ||
+	    nla_put_u32(skb, MCASP_ATTR_SEQ, READ_ONCE(mcasp->stream.seq)) ||
+	    nla_put_u32(skb, MCASP_ATTR_DROPPED, READ_ONCE(mcasp->stream.dropped)) ||
+	    nla_put_u32(skb, MCASP_ATTR_STARTS, mcasp->stats.starts) ||
+	    nla_put_u32(skb, MCASP_ATTR_TX_UNDERRUNS, mcasp->stats.tx_underruns) ||
+	    nla_put_u32(skb, MCASP_ATTR_RX_OVERRUNS, mcasp->stats.rx_overruns) ||
+	    nla_put_u32(skb, MCASP_ATTR_CLOCK_FAILS, mcasp->stats.clock_fails) ||
+	    nla_put_u32(skb, MCASP_ATTR_RECOVERIES, mcasp->stats.recoveries))
+		return -EMSGSIZE;
 
 	return 0;
 }
 
-static int mcasp_sw_init(struct davinci_mcasp *mcasp) {
-	unsigned long tx_page, rx_page;
-	int retval, err = 0;
-	dev_t chrdev = 0;
+static int mcasp_genl_get(struct sk_buff *skb, struct genl_info *info) {
+	struct davinci_mcasp *mcasp = mcasp_genl_dev;
+	struct sk_buff *msg;
+	void *hdr;
+	int retval;
 
-	tx_page = get_zeroed_page(GFP_KERNEL);
-	if (!tx_page) {
-		retval =  -ENOMEM;
-		goto err;
-	}
+	msg = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
 
-	rx_page = get_zeroed_page(GFP_KERNEL);
-	if (!rx_page) {
-		retval =  -ENOMEM;
-		goto err;
+	hdr = genlmsg_put_reply(msg, info, &mcasp_genl_family, 0, MCASP_CMD_GET);
+	if (!hdr) {
+		nlmsg_free(msg);
+		return -EMSGSIZE;
 	}
 
-	if(mcasp->tx_buf.buf) {
-		free_page(tx_page);
-	} else {
-		mcasp->tx_buf.buf = (u32 *) tx_page;
-	}
+	mutex_lock(&mcasp->lock);
+	retval = mcasp_genl_fill(msg, mcasp);
+	mutex_unlock(&mcasp->lock);
 
-	if(mcasp->rx_buf.buf) {
-		free_page(rx_page);
-	} else {
-		mcasp->rx_buf.buf = (u32 *) rx_page;
+	if (retval) {
+		nlmsg_free(msg);
+		return retval;
 	}
 
-	mcasp->tx_buf.head = mcasp->tx_buf.tail = 0;
-	mcasp->rx_buf.head = mcasp->rx_buf.tail = 0;
+	genlmsg_end(msg, hdr);
+	return genlmsg_reply(msg, info);
+}
 
-	// alloc_chrdev_region — register a range of char device numbers
-	err = alloc_chrdev_region(&chrdev, 0, 1, MCASP_DEVICE_NAME);
-	if (err < 0) {
-		dev_alert(mcasp->dev, "failed to register a majon number");
-		return err;
+static int mcasp_genl_set(struct sk_buff *skb, struct genl_info *info) {
+	struct davinci_mcasp *mcasp = mcasp_genl_dev;
+	struct nlattr **attrs = info->attrs;
+	u32 batch = 0;
+	int retval = 0;
+
+	if (attrs[MCASP_ATTR_BATCH]) {
+		batch = nla_get_u32(attrs[MCASP_ATTR_BATCH]);
+		if (!batch || batch > MCASP_GENL_MAX_BATCH)
+			return -EINVAL;
 	}
 
-	mcasp->majorNum = MAJOR(chrdev);
+	mutex_lock(&mcasp->lock);
 
-	cdev_init(&mcasp->cdev, &mcasp_file_ops);
-	mcasp->cdev.owner = THIS_MODULE;
-	mcasp->cdev.ops = &mcasp_file_ops;
+	if (attrs[MCASP_ATTR_LOOPBACK])
+		retval = mcasp_set_loopback(mcasp, nla_get_u8(attrs[MCASP_ATTR_LOOPBACK]) != 0);
 
-	err = cdev_add(&mcasp->cdev, chrdev, 1);
-	if(err) {
-		dev_alert(mcasp->dev, "cdev_add failed %d", err);
-		return err;
-	}
+	if (!retval && attrs[MCASP_ATTR_PROFILE])
+		retval = mcasp_switch_profile(mcasp, nla_get_u32(attrs[MCASP_ATTR_PROFILE]));
 
-	dev_info(mcasp->dev, "registred device %d", mcasp->majorNum);
-	dev_info(mcasp->dev, "mknod /dev/mcasp c %d 0", mcasp->majorNum);
+	if (!retval && batch)
+		WRITE_ONCE(mcasp->stream.batch, batch);
 
-	return retval;
+	if (!retval && attrs[MCASP_ATTR_STREAM])
+		WRITE_ONCE(mcasp->stream.enabled, nla_get_u8(attrs[MCASP_ATTR_STREAM]) != 0);
 
-err:
-	unregister_chrdev(mcasp->majorNum, MCASP_DEVICE_NAME);
+	mutex_unlock(&mcasp->lock);
 
 	return retval;
 }
 
-static int mcasp_start_tx(struct davinci_mcasp *mcasp) {
-	int cnt;
+static const struct nla_policy mcasp_genl_policy[MCASP_ATTR_MAX + 1] = {
+	[MCASP_ATTR_LOOPBACK]	= { .type = NLA_U8 },
+	[MCASP_ATTR_PROFILE]	= { .type = NLA_U32 },
+	[MCASP_ATTR_STREAM]	= { .type = NLA_U8 },
+	[MCASP_ATTR_BATCH]	= { .type = NLA_U32 },
+};
 
-	mcasp->tx_buf.head = mcasp->tx_buf.tail = 0;
+static const struct genl_ops mcasp_genl_ops[] = {
+	{
+		.cmd = MCASP_CMD_GET,
+		.doit = mcasp_genl_get,
+		.policy = mcasp_genl_policy,
+	},
+	{
+		.cmd = MCASP_CMD_SET,
+		.doit = mcasp_genl_set,
+		.policy = mcasp_genl_policy,
+		.flags = GENL_ADMIN_PERM,
+	},
+};
+
+static const struct genl_multicast_group mcasp_genl_mcgrps[] = {
+	[MCASP_GENL_GRP_STREAM] = { .name = MCASP_GENL_MCGRP_STREAM },
+	[MCASP_GENL_GRP_EVENTS] = { .name = MCASP_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family mcasp_genl_family = {
+	.name = MCASP_GENL_NAME,
+	.version = MCASP_GENL_VERSION,
+	.maxattr = MCASP_ATTR_MAX,
+	.module = THIS_MODULE,
+	.ops = mcasp_genl_ops,
+	.n_ops = ARRAY_SIZE(mcasp_genl_ops),
+	.mcgrps = mcasp_genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(mcasp_genl_mcgrps),
+};
+
+/* netlink is optional, the char device works without it */
+static void mcasp_genl_init(struct davinci_mcasp *mcasp) {
+	int ret;
 
-	dev_info(mcasp->dev, "Starting high freq TX clock");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, XHCLKRST);
+	mcasp->stream.batch = MCASP_GENL_MAX_BATCH / 4;
+	mcasp->stream.buf = devm_kcalloc(mcasp->dev, MCASP_GENL_MAX_BATCH, sizeof(u32), GFP_KERNEL);
+	if (!mcasp->stream.buf || mcasp_genl_dev)
+		return;
+
+	mcasp_genl_dev = mcasp;
+	ret = genl_register_family(&mcasp_genl_family);
+	if (ret) {
+		dev_warn(mcasp->dev, "netlink family registration failed %d", ret);
+		mcasp_genl_dev = NULL;
+		return;
+	}
 
-	dev_info(mcasp->dev, "Starting serial TX clock");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, XCLKRST);
+	mcasp->genl_registered = true;
+}
 
-	dev_info(mcasp->dev, "Starting TX serializers");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, XSRCLR);
+static void mcasp_genl_exit(struct davinci_mcasp *mcasp) {
 
-	cnt = 0;
-	while ((mcasp_get_reg(mcasp, DAVINCI_MCASP_XSTAT_REG) & XRDATA) && (cnt < 100000))
-		cnt++;
+	mutex_lock(&mcasp->lock);
+	mcasp->shutdown = true;
+	mutex_unlock(&mcasp->lock);
 
-	// REG_DUMP(mcasp, MCASP_WFIFOSTS_REG);
-	// mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), 0x11111111);
-	// mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), 0x22222222);
-	// mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), 0x33333333);
-	// mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), 0x44444444);
-	// mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), 0x55555555);
-	// mcasp_set_dat_reg(mcasp, DAVINCI_MCASP_XBUF_REG(AXRNTX), 0x66666666);
-	// REG_DUMP(mcasp, MCASP_WFIFOSTS_REG);
+	if (mcasp->genl_registered) {
+		genl_unregister_family(&mcasp_genl_family);
+		mcasp_genl_dev = NULL;
+	}
 
-	dev_info(mcasp->dev, "Enabling XDATA interrupt");
-	// mcasp_set_bits(mcasp, DAVINCI_MCASP_XINTCTL_REG, XSTAFRM);
+	cancel_delayed_work_sync(&mcasp->recover_work);
+	mcasp->genl_registered = false;
+	cancel_work_sync(&mcasp->event_work);
+}
 
-	dev_info(mcasp->dev, "Resetting TX state machine");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, XSMRST);
+/*
+ * In-kernel client API. Probed instances sit on a global list, a client
+ * claims one and then drives it like the ioctls do, under mcasp->lock.
+ */
+static LIST_HEAD(mcasp_instances);
+static DEFINE_MUTEX(mcasp_instances_lock);
 
-	dev_info(mcasp->dev, "Starting TX frame sync");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, XFSRST);
+static void mcasp_client_add(struct davinci_mcasp *mcasp) {
 
-	return 0;
+	mutex_lock(&mcasp_instances_lock);
+	list_add_tail(&mcasp->client.node, &mcasp_instances);
+	mutex_unlock(&mcasp_instances_lock);
 }
 
-static int mcasp_start_rx(struct davinci_mcasp *mcasp) {
+static void mcasp_client_del(struct davinci_mcasp *mcasp) {
 
-	mcasp->rx_buf.head = mcasp->rx_buf.tail = 0;
+	mutex_lock(&mcasp_instances_lock);
+	list_del(&mcasp->client.node);
+	if (mcasp->client.claimed)
+		dev_warn(mcasp->dev, "removed while claimed, client calls now fail");
+	mutex_unlock(&mcasp_instances_lock);
+}
 
-	dev_info(mcasp->dev, "Starting high freq RX clock");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, RHCLKRST);
+static void mcasp_free(struct kref *ref) {
+	kfree(container_of(ref, struct davinci_mcasp, ref));
+}
 
-	dev_info(mcasp->dev, "Starting serial RX clock");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, RCLKRST);
+static void mcasp_put(void *data) {
+	struct davinci_mcasp *mcasp = data;
 
-	dev_info(mcasp->dev, "Starting RX serializers");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, RSRCLR);
+	kref_put(&mcasp->ref, mcasp_free);
+}
 
-	dev_info(mcasp->dev, "Resetting RX state machine");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, RSMRST);
+/* no more submissions, the caller fails whatever is still queued */
+static void mcasp_client_gone(struct mcasp_client_state *c) {
+	unsigned long flags;
 
-	dev_info(mcasp->dev, "Starting RX frame sync");
-	mcasp_set_ctl_reg(mcasp, DAVINCI_MCASP_GBLCTL_REG, RFSRST);
+	spin_lock_irqsave(&c->lock, flags);
+	c->gone = true;
+	spin_unlock_irqrestore(&c->lock, flags);
+}
 
-	dev_info(mcasp->dev, "Enabling RDATA interrupt");
-	// mcasp_set_bits(mcasp, DAVINCI_MCASP_RINTCTL_REG, RLAST);
+/* fail everything not yet loaded, the worker must be parked or gone */
+static void mcasp_client_flush(struct mcasp_client_state *c, int status) {
+	struct mcasp_tx_req *req, *tmp;
+	unsigned long flags;
+	LIST_HEAD(dropped);
 
-	REG_DUMP_FORCE(mcasp, DAVINCI_MCASP_RSTAT_REG);
+	spin_lock_irqsave(&c->lock, flags);
+	list_splice_init(&c->tx_queue, &dropped);
+	spin_unlock_irqrestore(&c->lock, flags);
 
-	return 0;
+	if (c->cur) {
+		list_add(&c->cur->node, &dropped);
+		c->cur = NULL;
+	}
+
+	list_for_each_entry_safe(req, tmp, &dropped, node) {
+		list_del_init(&req->node);
+		if (req->complete)
+			req->complete(req, status);
+	}
 }
 
-static int mcasp_start(struct davinci_mcasp *mcasp) {
+struct davinci_mcasp *mcasp_client_claim(const char *name) {
+	struct davinci_mcasp *mcasp, *found = NULL;
+	int retval = -ENODEV;
+
+	mutex_lock(&mcasp_instances_lock);
+	list_for_each_entry(mcasp, &mcasp_instances, client.node) {
+		if (name && strcmp(dev_name(mcasp->dev), name))
+			continue;
+		if (mcasp->client.claimed) {
+			retval = -EBUSY;
+			continue;
+		}
+		found = mcasp;
+		break;
+	}
+
+	if (found && !try_module_get(THIS_MODULE))
+		found = NULL;
+	if (found) {
+		found->client.claimed = true;
+		kref_get(&found->ref);
+	}
+	mutex_unlock(&mcasp_instances_lock);
 
-	dev_info(mcasp->dev, "Starting McASP");
+	return found ? found : ERR_PTR(retval);
+}
+EXPORT_SYMBOL_GPL(mcasp_client_claim);
+
+/* also after remove, the last reference to a removed instance frees it */
+void mcasp_client_release(struct davinci_mcasp *mcasp) {
+	bool running;
+
+	mutex_lock(&mcasp->lock);
+	if (!mcasp->shutdown) {
+		running = mcasp->running;
+		mcasp_worker_park(mcasp);
+		mcasp_client_flush(&mcasp->client, -ECANCELED);
+		mcasp->client.rx_handler = NULL;
+		mcasp->client.rx_context = NULL;
+		if (running)
+			mcasp_worker_unpark(mcasp);
+	}
+	mutex_unlock(&mcasp->lock);
 
-	mcasp->worker = kthread_run(&mcasp_worker, mcasp, "mcasp_worker");
-	msleep(10);
-	mcasp_start_rx(mcasp);
-	mcasp_start_tx(mcasp);
+	mutex_lock(&mcasp_instances_lock);
+	mcasp->client.claimed = false;
+	mutex_unlock(&mcasp_instances_lock);
 
-	return 0;
+	mcasp_put(mcasp);
+	module_put(THIS_MODULE);
 }
+EXPORT_SYMBOL_GPL(mcasp_client_release);
 
-static int mcasp_stop_tx(struct davinci_mcasp *mcasp) {
+int mcasp_client_set_profile(struct davinci_mcasp *mcasp, const struct mcasp_profile *p) {
+	int retval;
 
-	dev_info(mcasp->dev, "Stopping McASP TX unit");
-	REG_DUMP_FORCE(mcasp, DAVINCI_MCASP_XSTAT_REG);
+	mutex_lock(&mcasp->lock);
+	retval = mcasp->shutdown ? -ENODEV : mcasp_set_profile(mcasp, p);
+	mutex_unlock(&mcasp->lock);
 
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XGBLCTL_REG, 0x0);
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_XSTAT_REG, 0xFFFF);
-	REG_DUMP_FORCE(mcasp, DAVINCI_MCASP_XSTAT_REG);
+	return retval;
+}
+EXPORT_SYMBOL_GPL(mcasp_client_set_profile);
 
-	return 0;
+int mcasp_client_switch_profile(struct davinci_mcasp *mcasp, int index) {
+	int retval;
+
+	mutex_lock(&mcasp->lock);
+	retval = mcasp->shutdown ? -ENODEV : mcasp_switch_profile(mcasp, index);
+	mutex_unlock(&mcasp->lock);
+
+	return retval;
 }
+EXPORT_SYMBOL_GPL(mcasp_client_switch_profile);
 
-static int mcasp_stop_rx(struct davinci_mcasp *mcasp) {
-	dev_info(mcasp->dev, "Stopping McASP RX unit");
-	REG_DUMP_FORCE(mcasp, DAVINCI_MCASP_RSTAT_REG);
+int mcasp_client_set_loopback(struct davinci_mcasp *mcasp, bool enable) {
+	int retval;
 
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RGBLCTL_REG, 0x0);
-	mcasp_set_reg(mcasp, DAVINCI_MCASP_RSTAT_REG, 0xFFFF);
-	REG_DUMP_FORCE(mcasp, DAVINCI_MCASP_RSTAT_REG);
+	mutex_lock(&mcasp->lock);
+	retval = mcasp->shutdown ? -ENODEV : mcasp_set_loopback(mcasp, enable);
+	mutex_unlock(&mcasp->lock);
 
-	return 0;
+	return retval;
 }
+EXPORT_SYMBOL_GPL(mcasp_client_set_loopback);
 
-static int mcasp_stop(struct davinci_mcasp *mcasp) {
+/* queues req behind earlier ones, callable from any context */
+int mcasp_client_submit(struct davinci_mcasp *mcasp, struct mcasp_tx_req *req) {
+	unsigned long flags;
 
-	dev_info(mcasp->dev, "Stopping McASP");
-	kthread_stop(mcasp->worker);
-	mcasp_stop_tx(mcasp);
-	mcasp_stop_rx(mcasp);
+	if (!req->buf || !req->words)
+		return -EINVAL;
 
+	req->pos = 0;
+	spin_lock_irqsave(&mcasp->client.lock, flags);
+	if (mcasp->client.gone) {
+		spin_unlock_irqrestore(&mcasp->client.lock, flags);
+		return -ENODEV;
+	}
+	list_add_tail(&req->node, &mcasp->client.tx_queue);
+	spin_unlock_irqrestore(&mcasp->client.lock, flags);
 
 	return 0;
 }
+EXPORT_SYMBOL_GPL(mcasp_client_submit);
 
+/* NULL handler unregisters, the worker is out of the old one on return */
+int mcasp_client_set_rx_handler(struct davinci_mcasp *mcasp,
+	mcasp_rx_handler_t handler, void *context) {
+	bool running;
+
+	mutex_lock(&mcasp->lock);
+	if (mcasp->shutdown) {
+		mutex_unlock(&mcasp->lock);
+		return -ENODEV;
+	}
+	running = mcasp->running;
+	mcasp_worker_park(mcasp);
+	mcasp->client.rx_context = context;
+	mcasp->client.rx_handler = handler;
+	if (running)
+		mcasp_worker_unpark(mcasp);
+	mutex_unlock(&mcasp->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mcasp_client_set_rx_handler);
 
 static int mcaspspi_probe(struct platform_device *pdev)
 {
@@ -728,18 +4463,24 @@ static int mcaspspi_probe(struct platform_device *pdev)
 	int ret;
 	int clock_rate;
 
-	dev_info(&pdev->dev, "mcaspspi_probe %s", *&pdev->name);
+	dev_dbg(&pdev->dev, "mcaspspi_probe %s", *&pdev->name);
 
 	if (!pdev->dev.platform_data && !pdev->dev.of_node) {
 		dev_err(&pdev->dev, "No platform data supplied\n");
 		return -EINVAL;
 	}
 
-	mcasp = devm_kzalloc(&pdev->dev, sizeof(struct davinci_mcasp), GFP_KERNEL);
+	mcasp = kzalloc(sizeof(struct davinci_mcasp), GFP_KERNEL);
 	if (!mcasp) {
 		return -ENOMEM;
 	}
 
+	// a client may hold the instance past remove, devres drops our reference last
+	kref_init(&mcasp->ref);
+	ret = devm_add_action_or_reset(&pdev->dev, mcasp_put, mcasp);
+	if (ret)
+		return ret;
+
 	mem = platform_get_resource_byname(pdev, IORESOURCE_MEM, "mpu");
 	if (!mem) {
 		dev_warn(mcasp->dev, "\"mpu\" mem resource not found, using index 0\n");
@@ -760,7 +4501,7 @@ static int mcaspspi_probe(struct platform_device *pdev)
 		}
 	}
 
-	dev_info(&pdev->dev, "Memory area: Start: %lx,  End:%lx Size:%d\n", (unsigned long)mem->start, (unsigned long)mem->end, resource_size(mem));
+	dev_dbg(&pdev->dev, "Memory area: Start: %lx,  End:%lx Size:%d\n", (unsigned long)mem->start, (unsigned long)mem->end, resource_size(mem));
 
 	mcasp->dev = &pdev->dev;
 
@@ -776,6 +4517,25 @@ static int mcaspspi_probe(struct platform_device *pdev)
 
 	pm_runtime_enable(&pdev->dev);
 
+	mutex_init(&mcasp->lock);
+	init_completion(&mcasp->selftest.done);
+	init_waitqueue_head(&mcasp->capture.wait);
+	mutex_init(&mcasp->tx_lock);
+	spin_lock_init(&mcasp->gblctl_lock);
+	spin_lock_init(&mcasp->rx_ring.lock);
+	spin_lock_init(&mcasp->sched.lock);
+	INIT_LIST_HEAD(&mcasp->sched.queue);
+	spin_lock_init(&mcasp->client.lock);
+	seqcount_init(&mcasp->frame.latest_seq);
+	INIT_LIST_HEAD(&mcasp->client.tx_queue);
+	mcasp->loopback = loopback;
+	mcasp->prio_slot = -1;
+	mcasp_profiles_init(mcasp);
+	// the error IRQs queue these, they must exist before the IRQs do
+	INIT_WORK(&mcasp->event_work, mcasp_event_work);
+	INIT_DELAYED_WORK(&mcasp->recover_work, mcasp_recover_work);
+	INIT_DELAYED_WORK(&mcasp->clkmon.work, mcasp_clkmon_work);
+
 	irq = platform_get_irq_byname(pdev, "tx");
 	if (irq >= 0) {
 		irq_name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%s_tx", dev_name(&pdev->dev));
@@ -800,26 +4560,57 @@ static int mcaspspi_probe(struct platform_device *pdev)
 
 	dev_set_drvdata(&pdev->dev, mcasp);
 
+	// optional chip select for burst mode (gpmc_a11 / GPIO1_27 on the black)
+	mcasp->cs_gpio = devm_gpiod_get_optional(&pdev->dev, "cs", GPIOD_OUT_LOW);
+	if (IS_ERR(mcasp->cs_gpio)) {
+		dev_err(&pdev->dev, "cs gpio error");
+		ret = PTR_ERR(mcasp->cs_gpio);
+		goto err;
+	}
+
 	mcasp->clk = devm_clk_get(&pdev->dev, NULL);
-	clk_prepare_enable(mcasp->clk);
 	if (IS_ERR(mcasp->clk)) {
 		dev_err(&pdev->dev, "clock error");
 		ret = PTR_ERR(mcasp->clk);
 		goto err;
 	}
+	clk_prepare_enable(mcasp->clk);
 
 	clock_rate = clk_get_rate(mcasp->clk);
 	dev_info(mcasp->dev, "Functional clock rate is %d Hz", clock_rate);
 
 	pm_runtime_get_sync(mcasp->dev);
 
-	mcasp_sw_init(mcasp);
-	mcasp_hw_init(mcasp);
-	mcasp_start(mcasp);
+	ret = mcasp_sw_init(mcasp);
+	if (ret)
+		goto err_pm;
+
+	ret = mcasp_hw_init(mcasp);
+	if (!ret)
+		ret = mcasp_start(mcasp);
+	if (ret) {
+		dev_err(&pdev->dev, "start failed %d", ret);
+		goto err_sw;
+	}
+
+	// published last, the family points at this instance
+	mcasp_genl_init(mcasp);
+	mcasp_client_add(mcasp);
 
 	return 0;
 
+err_sw:
+	mcasp_stop(mcasp);
+	if (mcasp->worker)
+		kthread_stop(mcasp->worker);
+	mcasp_sw_exit(mcasp);
+err_pm:
+	pm_runtime_put(mcasp->dev);
+	clk_disable_unprepare(mcasp->clk);
 err:
+	mcasp->shutdown = true;
+	cancel_delayed_work_sync(&mcasp->recover_work);
+	cancel_work_sync(&mcasp->event_work);
 	pm_runtime_disable(&pdev->dev);
 	return ret;
 }
@@ -828,16 +4619,25 @@ static int mcaspspi_remove(struct platform_device *pdev)
 {
 	struct davinci_mcasp *mcasp = dev_get_drvdata(&pdev->dev);
 
+	mcasp_client_del(mcasp);
+	mcasp_genl_exit(mcasp);
+	cancel_delayed_work_sync(&mcasp->clkmon.work);
 	mcasp_stop(mcasp);
+	if (mcasp->worker)
+		kthread_stop(mcasp->worker);
 	pm_runtime_put(mcasp->dev);
+	clk_disable_unprepare(mcasp->clk);
 
-	if (mcasp->tx_buf.buf)
-		free_page((long unsigned int) mcasp->tx_buf.buf);
+	mcasp_client_gone(&mcasp->client);
+	mcasp_client_flush(&mcasp->client, -ESHUTDOWN);
 
-	if (mcasp->rx_buf.buf)
-		free_page((long unsigned int) mcasp->rx_buf.buf);
+	mcasp_queue_free(mcasp);
+	mcasp_capture_free(mcasp);
+	mcasp_sched_free(mcasp);
+	vfree(mcasp->pattern.cur);
+	vfree(mcasp->pattern.next);
 
-	cdev_del(&mcasp->cdev);
+	mcasp_sw_exit(mcasp);
 
 	pm_runtime_disable(&pdev->dev);
 	return 0;
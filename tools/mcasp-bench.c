@@ -0,0 +1,569 @@
+/*
+ * mcasp-bench.c
+ *
+ * Benchmarks and load generator for the McASP serial driver. Every result
+ * is printed as one line, a JSON object by default or key=value pairs with
+ * -f text, so runs can be compared between driver releases.
+ *
+ *   mcasp-bench [options] throughput|latency|syscall|all
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mcasp_ioctl.h"
+
+#define DEFAULT_DEV		"/dev/mcasp"
+#define MAX_SIZES		16
+#define LATENCY_TIMEOUT_NS	200000000ULL
+#define WORD_MASK		0xFFFF0000 // bits that survive the default profile
+
+struct options {
+	const char *dev;
+	double duration;
+	size_t sizes[MAX_SIZES];
+	int nsizes;
+	unsigned int iterations;
+	bool do_read;
+	bool do_write;
+	bool text;
+	bool keep_loopback;
+	const char *tag;
+};
+
+struct cpu_sample {
+	uint64_t ns;
+	struct rusage ru;
+	unsigned long long busy;
+	unsigned long long total;
+};
+
+static struct options opt = {
+	.dev = DEFAULT_DEV,
+	.duration = 5.0,
+	.sizes = { 4, 64, 1024, 4096 },
+	.nsizes = 4,
+	.iterations = 1000,
+	.do_read = true,
+	.do_write = true,
+};
+
+/*
+ * Output, one record per line
+ */
+static bool out_first;
+
+static void out_sep(void)
+{
+	if (!out_first)
+		putchar(opt.text ? ' ' : ',');
+	out_first = false;
+}
+
+static void out_str(const char *key, const char *val)
+{
+	out_sep();
+	if (opt.text) {
+		printf("%s=%s", key, val);
+		return;
+	}
+
+	printf("\"%s\":\"", key);
+	for (; *val; val++) {
+		if (*val == '"' || *val == '\\')
+			putchar('\\');
+		putchar(*val);
+	}
+	putchar('"');
+}
+
+static void out_u64(const char *key, uint64_t val)
+{
+	out_sep();
+	printf(opt.text ? "%s=%" PRIu64 : "\"%s\":%" PRIu64, key, val);
+}
+
+static void out_f(const char *key, double val)
+{
+	out_sep();
+	printf(opt.text ? "%s=%.3f" : "\"%s\":%.3f", key, val);
+}
+
+static void out_begin(const char *test)
+{
+	out_first = true;
+	if (!opt.text)
+		putchar('{');
+	out_str("test", test);
+	out_str("dev", opt.dev);
+	if (opt.tag)
+		out_str("tag", opt.tag);
+}
+
+static void out_end(void)
+{
+	if (!opt.text)
+		putchar('}');
+	putchar('\n');
+	fflush(stdout);
+}
+
+/*
+ * Time and CPU accounting. /proc/stat catches the driver worker thread,
+ * which getrusage of this process does not.
+ */
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void cpu_sample(struct cpu_sample *s)
+{
+	unsigned long long v[8] = { 0 };
+	FILE *f;
+
+	s->busy = s->total = 0;
+	f = fopen("/proc/stat", "r");
+	if (f) {
+		if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+			s->total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+			s->busy = s->total - v[3] - v[4];
+		}
+		fclose(f);
+	}
+
+	getrusage(RUSAGE_SELF, &s->ru);
+	s->ns = now_ns();
+}
+
+static double tv_sec(const struct timeval *a, const struct timeval *b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_usec - a->tv_usec) / 1e6;
+}
+
+static void out_cpu(const struct cpu_sample *a, const struct cpu_sample *b)
+{
+	double wall = (b->ns - a->ns) / 1e9;
+	double user = tv_sec(&a->ru.ru_utime, &b->ru.ru_utime);
+	double sys = tv_sec(&a->ru.ru_stime, &b->ru.ru_stime);
+
+	out_f("cpu_user_s", user);
+	out_f("cpu_sys_s", sys);
+	out_f("cpu_proc_pct", wall > 0 ? (user + sys) * 100.0 / wall : 0);
+	out_f("cpu_system_pct", b->total > a->total ?
+	      (b->busy - a->busy) * 100.0 / (b->total - a->total) : 0);
+}
+
+/* driver counters, older modules without GET_STATS just leave them out */
+static bool get_stats(int fd, struct mcasp_link_stats *ls)
+{
+	return ioctl(fd, MCASP_IOC_GET_STATS, ls) == 0;
+}
+
+static void out_stats(const struct mcasp_link_stats *a, const struct mcasp_link_stats *b)
+{
+	out_u64("underruns", b->tx_underruns - a->tx_underruns);
+	out_u64("overruns", b->rx_overruns - a->rx_overruns);
+}
+
+static int open_dev(void)
+{
+	int fd = open(opt.dev, O_RDWR);
+
+	if (fd < 0)
+		fprintf(stderr, "%s: %s\n", opt.dev, strerror(errno));
+	return fd;
+}
+
+/* words carry a counter in the bits the link keeps */
+static void fill_pattern(uint32_t *buf, size_t words, uint32_t *seq)
+{
+	size_t i;
+
+	for (i = 0; i < words; i++)
+		buf[i] = (*seq)++ << 16;
+}
+
+/*
+ * Sustained throughput, read and write interleaved on one descriptor
+ */
+static int run_throughput(size_t block)
+{
+	uint64_t rbytes = 0, wbytes = 0, rcalls = 0, wcalls = 0, rempty = 0, lapped = 0;
+	struct mcasp_link_stats ls0, ls1;
+	struct cpu_sample c0, c1;
+	uint64_t deadline;
+	uint32_t *wbuf, *rbuf, seq = 0;
+	bool stats;
+	ssize_t n;
+	int fd;
+
+	fd = open_dev();
+	if (fd < 0)
+		return -1;
+
+	wbuf = malloc(block);
+	rbuf = malloc(block);
+	if (!wbuf || !rbuf) {
+		close(fd);
+		free(wbuf);
+		free(rbuf);
+		return -1;
+	}
+
+	stats = get_stats(fd, &ls0);
+	cpu_sample(&c0);
+	deadline = c0.ns + (uint64_t)(opt.duration * 1e9);
+
+	while (now_ns() < deadline) {
+		if (opt.do_write) {
+			fill_pattern(wbuf, block / 4, &seq);
+			n = write(fd, wbuf, block);
+			wcalls++;
+			if (n > 0)
+				wbytes += n;
+			else if (n < 0 && errno != EAGAIN && errno != EINTR)
+				break;
+		}
+
+		if (opt.do_read) {
+			n = read(fd, rbuf, block);
+			rcalls++;
+			if (n > 0)
+				rbytes += n;
+			else if (n == 0)
+				rempty++;
+			else if (errno == EPIPE)
+				lapped++;
+			else if (errno != EAGAIN && errno != EINTR)
+				break;
+		}
+	}
+
+	cpu_sample(&c1);
+	if (stats)
+		stats = get_stats(fd, &ls1);
+
+	out_begin("throughput");
+	out_u64("block", block);
+	out_f("duration_s", (c1.ns - c0.ns) / 1e9);
+	if (opt.do_read) {
+		out_u64("read_bytes", rbytes);
+		out_f("read_Bps", rbytes * 1e9 / (c1.ns - c0.ns));
+		out_u64("read_calls", rcalls);
+		out_u64("read_empty", rempty);
+		out_u64("read_lapped", lapped);
+	}
+	if (opt.do_write) {
+		out_u64("write_bytes", wbytes);
+		out_f("write_Bps", wbytes * 1e9 / (c1.ns - c0.ns));
+		out_u64("write_calls", wcalls);
+	}
+	if (stats)
+		out_stats(&ls0, &ls1);
+	out_cpu(&c0, &c1);
+	out_end();
+
+	free(wbuf);
+	free(rbuf);
+	close(fd);
+	return 0;
+}
+
+/*
+ * Loopback round trip: write one marker word, poll until it comes back
+ */
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *v, unsigned int n, double p)
+{
+	unsigned int idx = (unsigned int)(p / 100.0 * n + 0.999999);
+
+	return v[idx ? idx - 1 : 0];
+}
+
+/* high bit set, never the idle filler or the block sync word */
+static uint32_t next_marker(uint32_t *seq)
+{
+	uint32_t m;
+
+	do {
+		m = 0x8000 | ((*seq)++ & 0x7FFF);
+	} while (m == (0xABCD0000 >> 16) || m == (MCASP_BLOCK_SYNC >> 16));
+
+	return m << 16;
+}
+
+/* skip to the ring head, being lapped just means we are there */
+static void drain(int fd)
+{
+	uint32_t buf[256];
+	ssize_t n;
+
+	do {
+		n = read(fd, buf, sizeof(buf));
+	} while (n > 0 || (n < 0 && errno == EPIPE));
+}
+
+static int run_latency(void)
+{
+	uint64_t *samples, t0, t1, sum = 0;
+	unsigned int i, ok = 0, lost = 0;
+	int old_loopback = 0, on = 1;
+	struct cpu_sample c0, c1;
+	uint32_t rbuf[64], marker, seq = 1;
+	bool found;
+	ssize_t n;
+	int fd, j;
+
+	fd = open_dev();
+	if (fd < 0)
+		return -1;
+
+	samples = calloc(opt.iterations, sizeof(*samples));
+	if (!samples) {
+		close(fd);
+		return -1;
+	}
+
+	if (!opt.keep_loopback) {
+		if (ioctl(fd, MCASP_IOC_GET_LOOPBACK, &old_loopback) ||
+		    ioctl(fd, MCASP_IOC_SET_LOOPBACK, &on)) {
+			fprintf(stderr, "loopback: %s\n", strerror(errno));
+			free(samples);
+			close(fd);
+			return -1;
+		}
+	}
+
+	cpu_sample(&c0);
+	for (i = 0; i < opt.iterations; i++) {
+		marker = next_marker(&seq);
+		drain(fd);
+
+		t0 = now_ns();
+		if (write(fd, &marker, sizeof(marker)) != sizeof(marker)) {
+			lost++;
+			continue;
+		}
+
+		found = false;
+		do {
+			n = read(fd, rbuf, sizeof(rbuf));
+			t1 = now_ns();
+			for (j = 0; j < n / 4 && !found; j++)
+				found = (rbuf[j] & WORD_MASK) == marker;
+		} while (!found && t1 - t0 < LATENCY_TIMEOUT_NS);
+
+		if (found) {
+			samples[ok++] = t1 - t0;
+			sum += t1 - t0;
+		} else {
+			lost++;
+		}
+	}
+	cpu_sample(&c1);
+
+	if (!opt.keep_loopback)
+		ioctl(fd, MCASP_IOC_SET_LOOPBACK, &old_loopback);
+
+	qsort(samples, ok, sizeof(*samples), cmp_u64);
+
+	out_begin("latency");
+	out_u64("iterations", opt.iterations);
+	out_u64("received", ok);
+	out_u64("lost", lost);
+	if (ok) {
+		out_u64("min_ns", samples[0]);
+		out_u64("mean_ns", sum / ok);
+		out_u64("p50_ns", percentile(samples, ok, 50));
+		out_u64("p90_ns", percentile(samples, ok, 90));
+		out_u64("p99_ns", percentile(samples, ok, 99));
+		out_u64("p999_ns", percentile(samples, ok, 99.9));
+		out_u64("max_ns", samples[ok - 1]);
+	}
+	out_cpu(&c0, &c1);
+	out_end();
+
+	free(samples);
+	close(fd);
+	return 0;
+}
+
+/*
+ * Cost per call and per byte of plain read()/write() at a given size
+ */
+static int run_syscall_op(int fd, size_t block, bool write_op)
+{
+	uint64_t calls = 0, bytes = 0, deadline, elapsed;
+	struct cpu_sample c0, c1;
+	uint32_t *buf, seq = 0;
+	ssize_t n;
+
+	buf = malloc(block);
+	if (!buf)
+		return -1;
+	fill_pattern(buf, block / 4, &seq);
+
+	cpu_sample(&c0);
+	deadline = c0.ns + (uint64_t)(opt.duration * 1e9);
+	while (now_ns() < deadline) {
+		n = write_op ? write(fd, buf, block) : read(fd, buf, block);
+		calls++;
+		if (n > 0)
+			bytes += n;
+	}
+	cpu_sample(&c1);
+	elapsed = c1.ns - c0.ns;
+
+	out_begin("syscall");
+	out_str("op", write_op ? "write" : "read");
+	out_u64("block", block);
+	out_u64("calls", calls);
+	out_u64("bytes", bytes);
+	out_f("ns_per_call", calls ? (double)elapsed / calls : 0);
+	out_f("ns_per_byte", bytes ? (double)elapsed / bytes : 0);
+	out_cpu(&c0, &c1);
+	out_end();
+
+	free(buf);
+	return 0;
+}
+
+static int run_syscall(size_t block)
+{
+	int fd, ret = 0;
+
+	fd = open_dev();
+	if (fd < 0)
+		return -1;
+
+	if (opt.do_read)
+		ret = run_syscall_op(fd, block, false);
+	if (!ret && opt.do_write)
+		ret = run_syscall_op(fd, block, true);
+
+	close(fd);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] throughput|latency|syscall|all\n"
+		"  -d DEV     device node (default " DEFAULT_DEV ", or $MCASP_DEV)\n"
+		"  -t SEC     duration of each throughput/syscall run (default 5)\n"
+		"  -b LIST    block sizes in bytes, multiples of 4 (default 4,64,1024,4096)\n"
+		"  -n N       latency round trips (default 1000)\n"
+		"  -m r|w|rw  directions for throughput/syscall (default rw)\n"
+		"  -k         keep the loopback setting, TX is wired to RX externally\n"
+		"  -T TAG     label added to every record, e.g. the driver version\n"
+		"  -f FMT     json (default) or text\n",
+		prog);
+}
+
+static int parse_sizes(char *arg)
+{
+	char *tok, *end;
+	unsigned long v;
+
+	opt.nsizes = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		v = strtoul(tok, &end, 0);
+		if (*end || !v || v % 4 || opt.nsizes == MAX_SIZES)
+			return -1;
+		opt.sizes[opt.nsizes++] = v;
+	}
+
+	return opt.nsizes ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *test;
+	int c, i, ret = 0;
+
+	if (getenv("MCASP_DEV"))
+		opt.dev = getenv("MCASP_DEV");
+
+	while ((c = getopt(argc, argv, "d:t:b:n:m:kT:f:h")) != -1) {
+		switch (c) {
+		case 'd':
+			opt.dev = optarg;
+			break;
+		case 't':
+			opt.duration = atof(optarg);
+			break;
+		case 'b':
+			if (parse_sizes(optarg)) {
+				fprintf(stderr, "bad block size list\n");
+				return 2;
+			}
+			break;
+		case 'n':
+			opt.iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opt.do_read = strchr(optarg, 'r') != NULL;
+			opt.do_write = strchr(optarg, 'w') != NULL;
+			break;
+		case 'k':
+			opt.keep_loopback = true;
+			break;
+		case 'T':
+			opt.tag = optarg;
+			break;
+		case 'f':
+			opt.text = !strcmp(optarg, "text");
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind != argc - 1 || opt.duration <= 0 || !opt.iterations ||
+	    (!opt.do_read && !opt.do_write)) {
+		usage(argv[0]);
+		return 2;
+	}
+	test = argv[optind];
+	if (strcmp(test, "throughput") && strcmp(test, "latency") &&
+	    strcmp(test, "syscall") && strcmp(test, "all")) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if (!strcmp(test, "throughput") || !strcmp(test, "all"))
+		for (i = 0; i < opt.nsizes && !ret; i++)
+			ret = run_throughput(opt.sizes[i]);
+
+	if (!ret && (!strcmp(test, "latency") || !strcmp(test, "all")))
+		ret = run_latency();
+
+	if (!strcmp(test, "syscall") || !strcmp(test, "all"))
+		for (i = 0; i < opt.nsizes && !ret; i++)
+			ret = run_syscall(opt.sizes[i]);
+
+	return ret ? 1 : 0;
+}